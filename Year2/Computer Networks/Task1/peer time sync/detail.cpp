@@ -166,16 +166,41 @@ namespace detail {
 
     // Method definition to get elapsed time in milliseconds
     int64_t NodeClock::get_time() const {
+        if (manual) {
+            return manual_time_us / 1000;
+        }
+
         auto now = std::chrono::steady_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
         return duration.count();
     }
 
-    // Comparator for sockaddr_in structures.
-    // Used for std::set and std::map.
-    bool sockaddr_in_cmp::operator()(const sockaddr_in& a, const sockaddr_in& b) const {
-        if (a.sin_addr.s_addr != b.sin_addr.s_addr)
-            return a.sin_addr.s_addr < b.sin_addr.s_addr;
-        return a.sin_port < b.sin_port;
+    // Get the elapsed time in microseconds.
+    int64_t NodeClock::get_time_us() const {
+        if (manual) {
+            return manual_time_us;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(now - start_time);
+        return duration.count();
+    }
+
+    // Stop following real time and report the given time in microseconds, for simulations.
+    void NodeClock::set_time_us(int64_t time) {
+        manual = true;
+        manual_time_us = time;
+    }
+
+    // Convert a time of this clock to an absolute CLOCK_MONOTONIC time, for timerfd.
+    // steady_clock counts from the same epoch as CLOCK_MONOTONIC on Linux.
+    timespec NodeClock::to_monotonic(int64_t time) const {
+        auto point = start_time + std::chrono::milliseconds(time);
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(point.time_since_epoch()).count();
+
+        timespec ts{};
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        return ts;
     }
 }   // namespace detail
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <chrono>
+#include <ctime>
 
 namespace detail {
     // Read a port number from a string.
@@ -42,15 +43,17 @@ namespace detail {
         public:
             NodeClock();                // Constructor.
             int64_t get_time() const;   // Get the elapsed time in milliseconds.
+            int64_t get_time_us() const;    // Get the elapsed time in microseconds.
+            void set_time_us(int64_t time); // Stop following real time and report the given time
+                                            // in microseconds, for simulations.
+
+            // Convert a time of this clock to an absolute CLOCK_MONOTONIC time, for timerfd.
+            timespec to_monotonic(int64_t time) const;
         
         private:
             std::chrono::steady_clock::time_point start_time;
-    };
-
-    // Comparator for sockaddr_in structures.
-    // Used for std::set and std::map.
-    struct sockaddr_in_cmp {
-        bool operator()(const sockaddr_in& a, const sockaddr_in& b) const;
+            bool manual = false;        // Whether the time is set by hand.
+            int64_t manual_time_us = 0; // Time reported when set by hand.
     };
 }
 #endif // PEER_DETAIL_H
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "event_loop.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "err.h"
+
+// Create the epoll instance, exits the program on failure.
+EventLoop::EventLoop() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        syserr("epoll_create1");
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+EventLoop::~EventLoop() {
+    close(epoll_fd);
+}
+
+// Start watching a descriptor for reading.
+void EventLoop::add(int fd) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        syserr("epoll_ctl");
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+// Wait for readable descriptors and store them in ready.
+// Returns false if interrupted by a signal.
+bool EventLoop::wait(std::vector<int>& ready, sigset_t const* mask) {
+    epoll_event events[16];
+
+    ready.clear();
+    int count = epoll_pwait(epoll_fd, events, sizeof(events) / sizeof(events[0]), -1, mask);
+    if (count < 0) {
+        if (errno == EINTR) {
+            return false;
+        }
+
+        syserr("epoll_pwait");
+        std::exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        ready.push_back(events[i].data.fd);
+    }
+
+    return true;
+}
+
+// Create a disarmed timer, exits the program on failure.
+Timer::Timer() {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        syserr("timerfd_create");
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+Timer::~Timer() {
+    close(timer_fd);
+}
+
+int Timer::fd() const {
+    return timer_fd;
+}
+
+// Arm the timer at a time of clock, or disarm it with std::nullopt.
+// Setting the timer clears its expiration, so passed deadlines are always set again.
+void Timer::set(std::optional<int64_t> deadline, detail::NodeClock const& clock) {
+    if (deadline == armed && (!deadline.has_value() || deadline.value() > clock.get_time())) {
+        return;
+    }
+
+    itimerspec spec{};
+    if (deadline.has_value()) {
+        spec.it_value = clock.to_monotonic(deadline.value());
+    }
+
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        syserr("timerfd_settime");
+        std::exit(EXIT_FAILURE);
+    }
+
+    armed = deadline;
+}
@@ -0,0 +1,53 @@
+#ifndef PEER_EVENT_LOOP_H
+#define PEER_EVENT_LOOP_H
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include <signal.h>
+
+#include "detail.h"
+
+// Readiness loop based on epoll, descriptors are level-triggered.
+class EventLoop {
+    public:
+        EventLoop();                // Create the epoll instance, exits the program on failure.
+        ~EventLoop();
+
+        EventLoop(EventLoop const&) = delete;
+        EventLoop& operator=(EventLoop const&) = delete;
+
+        // Start watching a descriptor for reading.
+        void add(int fd);
+
+        // Wait for readable descriptors and store them in ready.
+        // Signals are unblocked with mask while waiting.
+        // Returns false if interrupted by a signal.
+        bool wait(std::vector<int>& ready, sigset_t const* mask);
+
+    private:
+        int epoll_fd;
+};
+
+// Deadline in the node's natural clock, backed by a timerfd.
+// The descriptor is readable once the deadline passes, until the timer is reset.
+class Timer {
+    public:
+        Timer();                    // Create a disarmed timer, exits the program on failure.
+        ~Timer();
+
+        Timer(Timer const&) = delete;
+        Timer& operator=(Timer const&) = delete;
+
+        int fd() const;
+
+        // Arm the timer at a time of clock, or disarm it with std::nullopt.
+        // Also consumes a past expiration.
+        void set(std::optional<int64_t> deadline, detail::NodeClock const& clock);
+
+    private:
+        int timer_fd;
+        std::optional<int64_t> armed;   // Current deadline.
+};
+
+#endif // PEER_EVENT_LOOP_H
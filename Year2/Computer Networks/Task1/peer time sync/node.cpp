@@ -0,0 +1,788 @@
+#include "node.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+#include <sys/socket.h>
+
+#include "err.h"
+
+uint8_t buffer[MAX_PACKET_SIZE];
+
+// Start a node with no peers and no sync.
+void init_node(NodeContext& context, Config const& config) {
+    context.synchronized = 255;
+    context.offset = 0;
+    context.last_sent_sync = 0;
+    context.config = config;
+    context.offset_filter = OffsetFilter(config.filter_window, SYNC_LOSS_TIMEOUT_MS);
+}
+
+// Natural time of a node's clock reading in microseconds, in units of the node's timestamps.
+int64_t to_timestamp(NodeContext const& context, int64_t natural_us) {
+    return context.config.high_resolution ? natural_us : natural_us / 1000;
+}
+
+// Current natural time in units of the node's timestamps.
+int64_t natural_timestamp(NodeContext const& context) {
+    return to_timestamp(context, context.natural_clock.get_time_us());
+}
+
+// Send size bytes of buffer to address, through the transport if the node has one.
+static bool send_message(NodeContext const& context, std::size_t size, sockaddr_in const* address) {
+    if (context.transport != nullptr) {
+        return context.transport->send(context, buffer, size, *address);
+    }
+
+    ssize_t sent = sendto(context.my_socket, buffer, size, 0,
+                          reinterpret_cast<sockaddr const*>(address), sizeof(*address));
+    return sent >= 0;
+}
+
+// Send prepared messages with sendmmsg, or one by one through the transport.
+// Returns the number of sent messages, -1 with errno set if the first one fails.
+static int send_messages(NodeContext const& context, mmsghdr* msgs, std::size_t count) {
+    if (context.transport == nullptr) {
+        return sendmmsg(context.my_socket, msgs, count, 0);
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+        msghdr const& hdr = msgs[i].msg_hdr;
+        if (!context.transport->send(context, static_cast<uint8_t const*>(hdr.msg_iov->iov_base),
+                                     hdr.msg_iov->iov_len, *static_cast<sockaddr_in const*>(hdr.msg_name))) {
+            if (i == 0) {
+                errno = EIO;
+                return -1;
+            }
+            return i;
+        }
+    }
+
+    return count;
+}
+
+// Request the page of peers at cursor from the peer given in the config.
+// A request that fails to send is repeated like a lost one.
+static void request_peers(NodeContext& context, uint32_t cursor) {
+    MessageFields request{};
+    request.cursor = cursor;
+    std::size_t size = encode<MESSAGE::PEERS_REQUEST>(buffer, request);
+
+    context.discovery_cursor = cursor;
+    context.discovery_request_time = context.natural_clock.get_time();
+
+    if (!send_message(context, size, &context.config.peer_address.value())) {
+        msg_error(buffer);
+    }
+}
+
+// Send HELLO to the peer given in the config, or request the first page of
+// peers with paged discovery.
+void join(NodeContext& context) {
+    if (!context.config.peer_address.has_value()) {
+        return;
+    }
+
+    if (context.config.discovery_limit.has_value()) {
+        context.discovery_retries = 0;
+        request_peers(context, 0);
+        return;
+    }
+
+    std::size_t size = encode<MESSAGE::HELLO>(buffer);
+    if (!send_message(context, size, &context.config.peer_address.value())) {
+        msg_error(buffer);
+    }
+}
+
+// Handle GET_TIME message.
+// Return current time, with offset.
+// TIME is always in milliseconds, clients asking for the time don't know our resolution.
+void get_time_handler(NodeContext const& context, sockaddr_in const* msg_address) {
+    int64_t time = natural_timestamp(context) - context.offset;
+
+    MessageFields response{};
+    response.timestamp = context.config.high_resolution ? time / 1000 : time;
+    response.synchronized = context.synchronized;
+
+    std::size_t size = encode<MESSAGE::TIME>(buffer, response);
+
+    if (!send_message(context, size, msg_address)) {
+        msg_error(buffer);
+    }
+}
+
+// Handle HELLO message.
+// Send HELLO_REPLY with known peers.
+void hello_handler(NodeContext& context, sockaddr_in const* msg_address) {
+    Peer* sender = context.peers.find(*msg_address);
+    if (sender != nullptr && sender->connected) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Message to be sent will be to big.
+    std::size_t peer_count = context.peers.connected_size();
+    if (HELLO_REPLY_SIZE + peer_count * PEER_RECORD_SIZE > MAX_PACKET_SIZE) {
+        msg_error(buffer);
+        return;
+    }
+
+    MessageFields response{};
+    response.count = peer_count;
+    uint8_t* ptr = buffer + encode<MESSAGE::HELLO_REPLY>(buffer, response);
+
+    // Iterate through known peers and save them to the buffer.
+    for (auto const& peer : context.peers.connected_peers()) {
+        encode_peer(ptr, peer);
+        ptr += PEER_RECORD_SIZE;
+    }
+
+    if (!send_message(context, ptr - buffer, msg_address)) {
+        msg_error(buffer);
+        return;
+    }
+
+    context.peers.connect(context.peers.insert(*msg_address));
+}
+
+// Handle HELLO_REPLY message.
+// Save peers and send them CONNECT.
+void hello_reply_handler(NodeContext& context, sockaddr_in const* msg_address, ssize_t len) {
+    // To little received.
+    if ((std::size_t)len < HELLO_REPLY_SIZE) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Ignore if received not from our original peer.
+    if (!context.config.peer_address.has_value() ||
+        !detail::is_same_sockaddr_in(*msg_address, context.config.peer_address.value())) {
+        msg_error(buffer);
+        return;
+    }
+
+    uint16_t count = decode_count<MESSAGE::HELLO_REPLY>(buffer);
+
+    // Incorrect message due to errors in size.
+    if ((std::size_t)len != HELLO_REPLY_SIZE + PEER_RECORD_SIZE * count) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Iterate through received peers and add them to pending peers.
+    uint8_t const* ptr = buffer + HELLO_REPLY_SIZE;
+    for (uint16_t i = 0; i < count; ++i, ptr += PEER_RECORD_SIZE) {
+        // We work only in IPv4.
+        sockaddr_in peer;
+        if (!decode_peer(ptr, peer)) {
+            msg_error(buffer);
+            return;
+        }
+
+        // Invalid port.
+        if (peer.sin_port == 0)  {
+            context.peers.clear_pending();
+            msg_error(buffer);
+            return;
+        }
+
+        context.peers.insert(peer).pending = true;
+
+        // If peer is us or sender, ignore message.
+        if (detail::is_me(&context.config.bind_address, &peer) ||
+            detail::is_same_sockaddr_in(peer, context.config.peer_address.value())) {
+            context.peers.clear_pending();
+            msg_error(buffer);
+            return;
+        }
+    }
+
+    context.peers.connect(context.peers.insert(*msg_address));
+
+    // Iterate through received peers and send CONNECT.
+    context.peers.for_each([&](Peer const& peer) {
+        if (!peer.pending) {
+            return;
+        }
+
+        std::size_t size = encode<MESSAGE::CONNECT>(buffer);
+
+        if (!send_message(context, size, &peer.address)) {
+            msg_error(buffer);
+        }
+    });
+}
+
+// Handle CONNECT message.
+// Send ACK_CONNECT and add to known peers.
+void connect_handler(NodeContext& context, sockaddr_in const* msg_address) {
+    Peer& peer = context.peers.insert(*msg_address);
+    if (peer.pending) {
+        msg_error(buffer);
+        return;
+    }
+
+    context.peers.connect(peer);
+    std::size_t size = encode<MESSAGE::ACK_CONNECT>(buffer);
+
+    if (!send_message(context, size, msg_address)) {
+        msg_error(buffer);
+    }
+}
+
+// Handle ACK_CONNECT message.
+// Add to known peers.
+void ack_connect_handler(NodeContext& context, sockaddr_in const* msg_address) {
+    Peer* peer = context.peers.find(*msg_address);
+    if (peer != nullptr && peer->pending) {
+        peer->pending = false;
+        context.peers.connect(*peer);
+    } else {
+        msg_error(buffer);
+    }
+}
+
+// Handle PEERS_REQUEST message.
+// Send a page of at most PEERS_PAGE_SIZE known peers starting at the cursor.
+// The first page stands for HELLO, we connect the sender after sending it,
+// later pages are sent to connected peers only. The first page may be requested
+// again by a connected peer, if the previous one was lost.
+void peers_request_handler(NodeContext& context, sockaddr_in const* msg_address) {
+    uint32_t cursor = decode_cursor<MESSAGE::PEERS_REQUEST>(buffer);
+    Peer* sender = context.peers.find(*msg_address);
+    bool connected = sender != nullptr && sender->connected;
+    std::vector<sockaddr_in> const& peers = context.peers.connected_peers();
+
+    // Unexpected page.
+    if ((cursor != 0 && !connected) || cursor > peers.size()) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Iterate through known peers from the cursor, the sender doesn't need itself.
+    uint8_t* ptr = buffer + PEERS_SIZE;
+    uint16_t count = 0;
+    std::size_t next = cursor;
+    for (; next < peers.size() && count < PEERS_PAGE_SIZE; ++next) {
+        if (!detail::is_same_sockaddr_in(peers[next], *msg_address)) {
+            encode_peer(ptr, peers[next]);
+            ptr += PEER_RECORD_SIZE;
+            ++count;
+        }
+    }
+
+    // Cursor of the next page, 0 after the last one, and the requested one it answers.
+    MessageFields response{};
+    response.count = count;
+    response.cursor = next < peers.size() ? next : 0;
+    response.request_cursor = cursor;
+    encode<MESSAGE::PEERS>(buffer, response);
+
+    if (!send_message(context, ptr - buffer, msg_address)) {
+        msg_error(buffer);
+        return;
+    }
+
+    if (cursor == 0) {
+        context.peers.connect(context.peers.insert(*msg_address));
+    }
+}
+
+// Handle PEERS message, a page of peers during paged discovery.
+// Send CONNECT to new peers until we reach the discovery limit and request the next page.
+void peers_handler(NodeContext& context, sockaddr_in const* msg_address, ssize_t len) {
+    // To little received.
+    if ((std::size_t)len < PEERS_SIZE) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Ignore if not discovering or received not from our original peer.
+    if (!context.discovery_cursor.has_value() ||
+        !detail::is_same_sockaddr_in(*msg_address, context.config.peer_address.value())) {
+        msg_error(buffer);
+        return;
+    }
+
+    uint32_t cursor = decode_cursor<MESSAGE::PEERS>(buffer);
+    uint16_t count = decode_count<MESSAGE::PEERS>(buffer);
+
+    // Incorrect message due to errors in size.
+    if ((std::size_t)len != PEERS_SIZE + PEER_RECORD_SIZE * count) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Duplicated or late page, not the one we requested.
+    if (decode_request_cursor<MESSAGE::PEERS>(buffer) != context.discovery_cursor.value()) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Validate the whole page first, as HELLO_REPLY a single invalid peer rejects it.
+    std::vector<sockaddr_in> page(count);
+    uint8_t const* ptr = buffer + PEERS_SIZE;
+    for (uint16_t i = 0; i < count; ++i, ptr += PEER_RECORD_SIZE) {
+        if (!decode_peer(ptr, page[i]) || page[i].sin_port == 0 ||
+            detail::is_me(&context.config.bind_address, &page[i]) ||
+            detail::is_same_sockaddr_in(page[i], context.config.peer_address.value())) {
+            msg_error(buffer);
+            return;
+        }
+    }
+
+    context.peers.connect(context.peers.insert(*msg_address));
+
+    // Send CONNECT to peers we don't know yet.
+    std::size_t limit = context.config.discovery_limit.value();
+    std::size_t size = encode<MESSAGE::CONNECT>(buffer);
+    for (auto const& address : page) {
+        if (limit > 0 && context.discovered >= limit) {
+            break;
+        }
+
+        Peer& peer = context.peers.insert(address);
+        if (peer.connected || peer.pending) {
+            continue;
+        }
+        peer.pending = true;
+        ++context.discovered;
+
+        if (!send_message(context, size, &address)) {
+            msg_error(buffer);
+        }
+    }
+
+    // Discovery ends after the last page or once we have enough peers.
+    if (cursor == 0 || (limit > 0 && context.discovered >= limit)) {
+        context.discovery_cursor = std::nullopt;
+        return;
+    }
+
+    context.discovery_retries = 0;
+    request_peers(context, cursor);
+}
+
+// Handle SYNC_START message.
+// Send DELAY_REQUEST if valid.
+void sync_start_handler(NodeContext& context, sockaddr_in const* msg_address, int64_t receive_time) {
+    int64_t sync_time1 = receive_time;
+    int64_t sync_time0 = decode_timestamp<MESSAGE::SYNC_START>(buffer);
+    uint8_t synchronized = decode_synchronized<MESSAGE::SYNC_START>(buffer);
+
+    // Negative time.
+    if (sync_time0 < 0) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Unknown peer.
+    Peer* peer = context.peers.find(*msg_address);
+    if (peer == nullptr || !peer->connected) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Peer not eligible to sync from.
+    if (synchronized >= 254) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Synced with sender, his sync level is to high.
+    if (synchronized >= context.synchronized &&
+        (context.sync_from.has_value() &&
+        detail::is_same_sockaddr_in(*msg_address, context.sync_from.value()))) {
+        context.sync_from = std::nullopt;
+        context.synchronized = 255;
+        context.sync_times.fill(0);
+        context.sync_synchronized = std::nullopt;
+        context.syncing_from = std::nullopt;
+        context.sync_attempt_from = std::nullopt;
+        context.offset = 0;
+        msg_error(buffer);
+        return;
+    }
+
+    // Not synced with sender, his sync level is to high.
+    if (synchronized + 1 >= context.synchronized &&
+        (!context.sync_from.has_value() ||
+        !detail::is_same_sockaddr_in(*msg_address, context.sync_from.value()))) {
+        msg_error(buffer);
+        return;
+    }
+
+    std::size_t size = encode<MESSAGE::DELAY_REQUEST>(buffer);
+
+    if (!send_message(context, size, msg_address)) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Saves syncing progress.
+    context.sync_attempt_from = context.natural_clock.get_time();
+    context.sync_times[2] = natural_timestamp(context);
+    context.sync_times[1] = sync_time1;
+    context.sync_times[0] = sync_time0;
+    context.syncing_from = *msg_address;
+    context.sync_synchronized = synchronized;
+}
+
+// Handle DELAY_REQUEST message.
+// Validate and send DELAY_RESPONSE.
+void delay_request_handler(NodeContext& context, sockaddr_in const* msg_address, int64_t receive_time) {
+    Peer* peer = context.peers.find(*msg_address);
+
+    // Sender did not receive SYNC_START from us.
+    if (peer == nullptr || peer->sync_attempt_to < 0) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Syncing timed out.
+    if (peer->sync_attempt_to + SYNC_TIMEOUT_MS < context.natural_clock.get_time()) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Already received DELAY_REQUEST from this node during this sync process.
+    if (peer->delay_request_received) {
+        msg_error(buffer);
+        return;
+    }
+
+    peer->delay_request_received = true;
+
+    MessageFields response{};
+    response.synchronized = context.synchronized;
+    response.timestamp = receive_time - context.offset;     // Synchronized T4.
+
+    std::size_t size = encode<MESSAGE::DELAY_RESPONSE>(buffer, response);
+    if (!send_message(context, size, msg_address)) {
+        msg_error(buffer);
+    }
+}
+
+// Handle DELAY_RESPONSE message.
+// Validate and sync from sender.
+void delay_response_handler(NodeContext& context, sockaddr_in const* msg_address) {
+    uint8_t synchronized = decode_synchronized<MESSAGE::DELAY_RESPONSE>(buffer);
+    int64_t timestamp = decode_timestamp<MESSAGE::DELAY_RESPONSE>(buffer);
+
+    // Not syncing from sender.
+    if (!context.syncing_from.has_value() ||
+        !detail::is_same_sockaddr_in(*msg_address, context.syncing_from.value())) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Sender's sync level changed.
+    if (synchronized != context.sync_synchronized.value()) {
+        msg_error(buffer);
+        return;
+    }
+
+    // Syncing timed out.
+    if (context.sync_attempt_from.has_value() &&
+        context.sync_attempt_from.value() + SYNC_TIMEOUT_MS < context.natural_clock.get_time()) {
+        context.syncing_from = std::nullopt;
+        context.sync_attempt_from = std::nullopt;
+        msg_error(buffer);
+        return;
+    }
+
+    // Negative time.
+    if (timestamp < 0) {
+        context.syncing_from = std::nullopt;
+        context.sync_attempt_from = std::nullopt;
+        context.sync_times.fill(0);
+    }
+
+    context.sync_times[3] = timestamp;
+
+    // Calculate offset of this exchange, the offset we use comes from the one with the
+    // shortest round trip among recent exchanges with the sender.
+    int64_t offset = ((context.sync_times[1] - context.sync_times[0] +
+                      context.sync_times[2] - context.sync_times[3]) / 2);
+    int64_t delay = (context.sync_times[1] - context.sync_times[0]) +
+                    (context.sync_times[3] - context.sync_times[2]);
+
+    // Exchanges with another node, or with the sender at another sync level, measured
+    // a different clock.
+    if (!context.sync_from.has_value() ||
+        !detail::is_same_sockaddr_in(*msg_address, context.sync_from.value()) ||
+        context.synchronized != synchronized + 1) {
+        context.offset_filter.clear();
+    }
+    context.offset_filter.add(offset, delay, context.natural_clock.get_time());
+    context.offset = context.offset_filter.offset();
+
+    // We are now synced from sender.
+    context.sync_from = *msg_address;
+    context.synchronized = synchronized + 1;
+    context.syncing_from = std::nullopt;
+    context.sync_synchronized = std::nullopt;
+    context.sync_times.fill(0);
+    context.last_sync_time = context.natural_clock.get_time();
+}
+
+// Handle LEADER message.
+void leader_handler(NodeContext& context) {
+    uint8_t synchronized = decode_synchronized<MESSAGE::LEADER>(buffer);
+
+    // We are a leader.
+    if (context.synchronized == 0) {
+        // Wrong synchronized level.
+        if (synchronized != 255) {;
+            msg_error(buffer);
+            return;
+        }
+
+        // We are now not synchronized with anyone and not a leader.
+        context.synchronized = 255;
+        context.sync_from = std::nullopt;
+        context.syncing_from = std::nullopt;
+        context.sync_synchronized = std::nullopt;
+        context.sync_times.fill(0);
+        context.sync_attempt_from = std::nullopt;
+        context.offset = 0;
+        context.last_sync_time = std::nullopt;
+    } else {    // We are not a leader.
+        // Wrong synchronized value.
+        if (synchronized != 0) {
+            msg_error(buffer);
+            return;
+        }
+
+        // We are now a leader.
+        context.synchronized = 0;
+        context.sync_from = std::nullopt;
+        context.syncing_from = std::nullopt;
+        context.sync_synchronized = std::nullopt;
+        context.sync_times.fill(0);
+        context.sync_attempt_from = std::nullopt;
+        context.offset = 0;
+        context.last_sync_time = std::nullopt;
+        context.leader_time = context.natural_clock.get_time();
+    }
+}
+
+// Time after which we should send SYNC_START to our peers, if any.
+// Leaders wait LEADER_TIMEOUT_MS after becoming one.
+std::optional<int64_t> sync_sending_deadline(NodeContext const& context) {
+    if (context.synchronized >= 254) {
+        return std::nullopt;
+    }
+
+    int64_t deadline = context.last_sent_sync + SYNC_SENDING_INTERVAL_MS + 1;
+    if (context.synchronized == 0) {
+        if (!context.leader_time.has_value()) {
+            return std::nullopt;
+        }
+        deadline = std::max(deadline, context.leader_time.value() + LEADER_TIMEOUT_MS + 1);
+    }
+
+    return deadline;
+}
+
+// Time after which we lose sync with the node we are synced from, if any.
+std::optional<int64_t> sync_loss_deadline(NodeContext const& context) {
+    if (context.synchronized == 255 || !context.sync_from.has_value() ||
+        !context.last_sync_time.has_value()) {
+        return std::nullopt;
+    }
+
+    return context.last_sync_time.value() + SYNC_LOSS_TIMEOUT_MS + 1;
+}
+
+// Time after which our current syncing process times out, if any.
+std::optional<int64_t> sync_timeout_deadline(NodeContext const& context) {
+    if (!context.syncing_from.has_value() || !context.sync_attempt_from.has_value()) {
+        return std::nullopt;
+    }
+
+    return context.sync_attempt_from.value() + SYNC_TIMEOUT_MS + 1;
+}
+
+// Time after which we request the current page of peers again, if any.
+std::optional<int64_t> discovery_deadline(NodeContext const& context) {
+    if (!context.discovery_cursor.has_value()) {
+        return std::nullopt;
+    }
+
+    return context.discovery_request_time + DISCOVERY_TIMEOUT_MS + 1;
+}
+
+// Send SYNC_START to all peers.
+// Messages differ only in the destination, so batches of SEND_BATCH go out
+// with a single sendmmsg, all pointing at one message serialized in buffer.
+// Its timestamp is taken right before each batch.
+void send_sync_start(NodeContext& context) {
+    std::vector<Peer*> peers;
+    peers.reserve(context.peers.connected_size());
+    context.peers.for_each([&](Peer& peer) {
+        if (peer.connected) {
+            peers.push_back(&peer);
+        }
+    });
+    std::array<mmsghdr, SEND_BATCH> msgs;
+    iovec iov{buffer, SYNC_START_SIZE};
+
+    for (std::size_t first = 0; first < peers.size();) {
+        std::size_t count = std::min(SEND_BATCH, peers.size() - first);
+
+        MessageFields msg{};
+        msg.synchronized = context.synchronized;
+        msg.timestamp = natural_timestamp(context) - context.offset;        // Synchronized T1.
+
+        encode<MESSAGE::SYNC_START>(buffer, msg);
+
+        for (std::size_t i = 0; i < count; ++i) {
+            msgs[i] = mmsghdr{};
+            msgs[i].msg_hdr.msg_name = &peers[first + i]->address;
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            msgs[i].msg_hdr.msg_iov = &iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // Sending stops at the first failed message, the next call reports its error.
+        // Messages that fail are reported and skipped. With a full send buffer the
+        // rest of the round is dropped, those peers get SYNC_START in the next one.
+        int sent = send_messages(context, msgs.data(), count);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                err("Send buffer full, SYNC_START not sent to ", peers.size() - first, " peers");
+                break;
+            }
+
+            msg_error(buffer);
+            ++first;
+            continue;
+        }
+
+        int64_t now = context.natural_clock.get_time();
+        for (int i = 0; i < sent; ++i) {
+            peers[first + i]->sync_attempt_to = now;
+            peers[first + i]->delay_request_received = false;
+        }
+
+        first += sent;
+    }
+
+    context.last_sent_sync = context.natural_clock.get_time();
+}
+
+// Run timers whose deadlines passed.
+void process_timers(NodeContext& context) {
+    int64_t now = context.natural_clock.get_time();
+
+    // Sending SYNC_START to peers.
+    std::optional<int64_t> sync_sending = sync_sending_deadline(context);
+    if (sync_sending.has_value() && now >= sync_sending.value()) {
+        send_sync_start(context);
+    }
+
+    // Lose sync after timeout.
+    std::optional<int64_t> sync_loss = sync_loss_deadline(context);
+    if (sync_loss.has_value() && now >= sync_loss.value()) {
+        context.synchronized = 255;
+        context.sync_from = std::nullopt;
+        context.last_sync_time = std::nullopt;
+    }
+
+    // Terminate syncing process after timeout.
+    std::optional<int64_t> sync_timeout = sync_timeout_deadline(context);
+    if (sync_timeout.has_value() && now >= sync_timeout.value()) {
+        context.syncing_from = std::nullopt;
+        context.sync_attempt_from = std::nullopt;
+        context.sync_times.fill(0);
+    }
+
+    // Request the page of peers again, discovery ends after DISCOVERY_RETRIES lost pages.
+    std::optional<int64_t> discovery = discovery_deadline(context);
+    if (discovery.has_value() && now >= discovery.value()) {
+        if (context.discovery_retries < DISCOVERY_RETRIES) {
+            ++context.discovery_retries;
+            request_peers(context, context.discovery_cursor.value());
+        } else {
+            err("No PEERS received after ", DISCOVERY_RETRIES, " retries, discovery stopped");
+            context.discovery_cursor = std::nullopt;
+        }
+    }
+}
+
+// Validate the message of received bytes in buffer and pass it to its handler.
+void handle_message(NodeContext& context, sockaddr_in const* msg_address, ssize_t received,
+                    int64_t receive_time) {
+    // Received message comes from ourselves.
+    if (detail::is_me(&context.config.bind_address, msg_address)) {
+        msg_error(buffer);
+        return;
+    }
+
+    MESSAGE msg_type = static_cast<MESSAGE>(buffer[0]);
+    
+    // Check whether the message size is valid.
+    // As hello reply and peers are of variable size, the size checking will be done in the handler.
+    if(msg_type != MESSAGE::HELLO_REPLY && msg_type != MESSAGE::PEERS) {
+        if ((std::size_t)received != get_message_size(msg_type)) {
+            msg_error(buffer);
+            return;
+        }
+    }
+    
+    // React accordingly to message type.
+    switch (msg_type) {
+        case MESSAGE::GET_TIME:
+            get_time_handler(context, msg_address);
+            break;
+
+        case MESSAGE::HELLO:
+            hello_handler(context, msg_address);
+            break;
+        
+        case MESSAGE::HELLO_REPLY:
+            hello_reply_handler(context, msg_address, received);
+            break;
+
+        case MESSAGE::CONNECT:
+            connect_handler(context, msg_address);
+            break;
+
+        case MESSAGE::ACK_CONNECT:
+            ack_connect_handler(context, msg_address);
+            break;
+
+        case MESSAGE::PEERS_REQUEST:
+            peers_request_handler(context, msg_address);
+            break;
+
+        case MESSAGE::PEERS:
+            peers_handler(context, msg_address, received);
+            break;
+
+        case MESSAGE::SYNC_START:
+            sync_start_handler(context, msg_address, receive_time);
+            break;
+
+        case MESSAGE::DELAY_REQUEST:
+            delay_request_handler(context, msg_address, receive_time);
+            break;
+
+        case MESSAGE::DELAY_RESPONSE:
+            delay_response_handler(context, msg_address);
+            break;
+
+        case MESSAGE::LEADER:
+            leader_handler(context);
+            break;
+            
+        default:
+            msg_error(buffer);
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef PEER_NODE_H
+#define PEER_NODE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "protocol.h"
+#include "detail.h"
+#include "peer_table.h"
+#include "offset_filter.h"
+
+// Simple struct to hold console parameters in sockaddr_in.
+struct Config {
+    sockaddr_in bind_address;
+    std::optional<sockaddr_in> peer_address;
+    std::optional<std::size_t> discovery_limit;     // Join with paged discovery, connecting
+                                                    // to at most this many peers (0 for all).
+    bool high_resolution;                           // Timestamps in microseconds instead of milliseconds,
+                                                    // all nodes of the network must agree on it.
+    std::size_t filter_window = OFFSET_FILTER_WINDOW;   // Exchanges the offset is filtered over.
+};
+
+struct NodeContext;
+
+// Carrier of a node's datagrams in place of its socket, used by the simulator.
+class Transport {
+    public:
+        virtual ~Transport() = default;
+
+        // Take a datagram the node sends to address.
+        // Returns false if it can't be sent, as a failed sendto.
+        virtual bool send(NodeContext const& sender, uint8_t const* data, std::size_t size,
+                          sockaddr_in const& address) = 0;
+};
+
+// Current context/state of the node.
+struct NodeContext {
+    int my_socket;                              // Socket id.
+    Transport* transport;                       // Carries datagrams instead of the socket if set.
+    detail::NodeClock natural_clock;            // Natural clock.
+    int64_t offset;                             // Current offset (0) if not synced, in timestamp units.
+    OffsetFilter offset_filter;                 // Offsets of recent exchanges with the node we are synced from.
+    uint8_t synchronized;                       // Sync level of the node we are syncing from.
+    Config config;                              // Console parameters.
+    PeerTable peers;                            // Known and pending peers with their sync state.
+    std::optional<sockaddr_in> sync_from;       // Node from which we are synced.
+    std::optional<sockaddr_in> syncing_from;    // Node from which we are in the process of syncing.
+    std::optional<uint8_t> sync_synchronized;   // Above node's sync level.
+    std::array<int64_t, 4> sync_times;          // Times necessary to calculate sync offset, in timestamp units.
+    std::optional<int64_t> sync_attempt_from;   // Start time of our current syncing process.
+    std::optional<int64_t> last_sync_time;      // Last sync attempt from the node we are synced from.
+    std::optional<int64_t> leader_time;         // Time passed after becoming a leader.
+    std::optional<uint32_t> discovery_cursor;   // Page of peers we requested, during paged discovery.
+    int64_t discovery_request_time;             // Last time we requested the page.
+    std::size_t discovery_retries;              // Repeated requests of the page.
+    std::size_t discovered;                     // Peers we sent CONNECT to during paged discovery.
+    int64_t last_sent_sync;                     // Last time we sent SYNC_START to our peers.
+};
+
+constexpr int64_t SYNC_TIMEOUT_MS = 5000;           // Timeout for the syncing process.
+constexpr int64_t SYNC_LOSS_TIMEOUT_MS = 20000;     // Timeout for loosing sync after we haven't
+                                                    // received SYNC_START from the node we're synced from.
+
+constexpr int64_t SYNC_SENDING_INTERVAL_MS = 5000;  // Interval for sending SYNC_START.
+constexpr int64_t LEADER_TIMEOUT_MS = 2000;         // Waiting period after receiving becoming a leader.
+
+constexpr int64_t DISCOVERY_TIMEOUT_MS = 1000;      // Timeout for a requested page of peers.
+constexpr std::size_t DISCOVERY_RETRIES = 3;        // Repeated requests of a page before giving up.
+
+constexpr std::size_t SEND_BATCH = 256;             // SYNC_START messages sent with one sendmmsg.
+constexpr std::size_t PEERS_PAGE_SIZE = 64;         // Peers in a PEERS message, keeps it well below
+                                                    // the MTU, so it is never fragmented.
+
+// Message being handled or built, handlers find the received datagram here
+// and serialize their responses in place.
+extern uint8_t buffer[MAX_PACKET_SIZE];
+
+// Start a node with no peers and no sync.
+void init_node(NodeContext& context, Config const& config);
+
+// Natural time of a node's clock reading in microseconds, in units of the node's timestamps.
+int64_t to_timestamp(NodeContext const& context, int64_t natural_us);
+
+// Current natural time in units of the node's timestamps.
+int64_t natural_timestamp(NodeContext const& context);
+
+// Send HELLO to the peer given in the config, or request the first page of
+// peers with paged discovery. Does nothing without a peer.
+void join(NodeContext& context);
+
+// Time after which we should send SYNC_START to our peers, if any.
+std::optional<int64_t> sync_sending_deadline(NodeContext const& context);
+
+// Time after which we lose sync with the node we are synced from, if any.
+std::optional<int64_t> sync_loss_deadline(NodeContext const& context);
+
+// Time after which our current syncing process times out, if any.
+std::optional<int64_t> sync_timeout_deadline(NodeContext const& context);
+
+// Time after which we request the current page of peers again, if any.
+std::optional<int64_t> discovery_deadline(NodeContext const& context);
+
+// Run timers whose deadlines passed.
+void process_timers(NodeContext& context);
+
+// Validate the message of received bytes in buffer and pass it to its handler.
+// The message arrived at receive_time, a natural time in units of the node's timestamps.
+void handle_message(NodeContext& context, sockaddr_in const* msg_address, ssize_t received,
+                    int64_t receive_time);
+
+#endif // PEER_NODE_H
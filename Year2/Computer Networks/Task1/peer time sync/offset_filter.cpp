@@ -0,0 +1,48 @@
+#include "offset_filter.h"
+
+#include <algorithm>
+
+OffsetFilter::OffsetFilter() : OffsetFilter(OFFSET_FILTER_WINDOW) {}
+
+// Filter over the last window samples, at most MAX_OFFSET_FILTER_WINDOW,
+// taken at most max_age before the latest one.
+OffsetFilter::OffsetFilter(std::size_t window, int64_t max_age)
+    : samples{}, window(std::clamp<std::size_t>(window, 1, MAX_OFFSET_FILTER_WINDOW)), max_age(max_age),
+      count(0), next(0) {}
+
+// Record the offset and round trip delay of an exchange taken at time, replacing
+// the oldest one if the window is full and dropping ones older than max_age.
+// Samples come in time order, so the expired ones are the oldest.
+void OffsetFilter::add(int64_t offset, int64_t delay, int64_t time) {
+    while (count > 0 && time - samples[(next + window - count) % window].time > max_age) {
+        --count;
+    }
+
+    samples[next] = Sample{offset, delay, time};
+    next = (next + 1) % window;
+    count = std::min(count + 1, window);
+}
+
+// Offset of the kept exchange with the shortest round trip, 0 if there is none.
+// Ties go to the latest of the exchanges.
+int64_t OffsetFilter::offset() const {
+    if (count == 0) {
+        return 0;
+    }
+
+    std::size_t best = (next + window - 1) % window;
+    for (std::size_t age = 1; age < count; ++age) {
+        std::size_t slot = (next + window - 1 - age) % window;
+        if (samples[slot].delay < samples[best].delay) {
+            best = slot;
+        }
+    }
+
+    return samples[best].offset;
+}
+
+// Forget all exchanges.
+void OffsetFilter::clear() {
+    count = 0;
+    next = 0;
+}
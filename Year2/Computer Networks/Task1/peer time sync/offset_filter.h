@@ -0,0 +1,48 @@
+#ifndef PEER_OFFSET_FILTER_H
+#define PEER_OFFSET_FILTER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+constexpr std::size_t OFFSET_FILTER_WINDOW = 8;         // Default number of kept exchanges.
+constexpr std::size_t MAX_OFFSET_FILTER_WINDOW = 64;
+
+// Windowed minimum round trip filter of clock offset samples.
+// Queueing only ever adds delay, so the exchange with the shortest round trip
+// had the least room for asymmetric delays and its offset is the most accurate.
+class OffsetFilter {
+    public:
+        OffsetFilter();             // Filter over the last OFFSET_FILTER_WINDOW samples of any age.
+
+        // Filter over the last window samples, at most MAX_OFFSET_FILTER_WINDOW,
+        // taken at most max_age before the latest one.
+        explicit OffsetFilter(std::size_t window,
+                              int64_t max_age = std::numeric_limits<int64_t>::max());
+
+        // Record the offset and round trip delay of an exchange taken at time, replacing
+        // the oldest one if the window is full and dropping ones older than max_age.
+        void add(int64_t offset, int64_t delay, int64_t time);
+
+        // Offset of the kept exchange with the shortest round trip, 0 if there is none.
+        int64_t offset() const;
+
+        // Forget all exchanges.
+        void clear();
+
+    private:
+        struct Sample {
+            int64_t offset;
+            int64_t delay;
+            int64_t time;
+        };
+
+        std::array<Sample, MAX_OFFSET_FILTER_WINDOW> samples;
+        std::size_t window;         // Number of kept samples once full.
+        int64_t max_age;            // Age after which a sample is dropped, in units of sample times.
+        std::size_t count;          // Number of kept samples.
+        std::size_t next;           // Slot of the next sample.
+};
+
+#endif // PEER_OFFSET_FILTER_H
@@ -0,0 +1,304 @@
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <endian.h>
+
+#include "protocol.h"
+#include "err.h"
+
+// Previous std::optional based message header and its serialization,
+// kept as the reference the codec is checked and measured against.
+namespace legacy {
+    struct MessageHeader {
+        MESSAGE type;
+        std::optional<uint16_t> count;
+        std::optional<uint8_t> synchronized;
+        std::optional<int64_t> timestamp;
+    };
+
+    void serialize_header(MessageHeader const& header, uint8_t* buffer) {
+        std::memset(buffer, 0, MAX_PACKET_SIZE);
+
+        uint8_t* ptr = buffer;
+        *ptr = static_cast<uint8_t>(header.type);
+        ++ptr;
+
+        if (header.count.has_value()) {
+            uint16_t count = htons(header.count.value());
+            std::memcpy(ptr, &count, sizeof(count));
+            ptr += sizeof(count);
+        }
+
+        if (header.synchronized.has_value()) {
+            *ptr = header.synchronized.value();
+            ++ptr;
+        }
+
+        if (header.timestamp.has_value()) {
+            int64_t timestamp = htobe64(header.timestamp.value());
+            std::memcpy(ptr, &timestamp, sizeof(timestamp));
+            ptr += sizeof(timestamp);
+        }
+    }
+
+    MessageHeader deserialize_header(uint8_t const* buffer) {
+        uint8_t const* ptr = buffer;
+        MessageHeader header{};
+
+        header.type = static_cast<MESSAGE>(*ptr);
+        ++ptr;
+
+        switch (header.type) {
+            case MESSAGE::HELLO:
+            case MESSAGE::CONNECT:
+            case MESSAGE::ACK_CONNECT:
+            case MESSAGE::DELAY_REQUEST:
+            case MESSAGE::GET_TIME:
+                break;
+
+            case MESSAGE::HELLO_REPLY:
+                uint16_t count;
+                std::memcpy(&count, ptr, sizeof(count));
+                header.count = ntohs(count);
+                break;
+
+            case MESSAGE::SYNC_START:
+            case MESSAGE::DELAY_RESPONSE:
+            case MESSAGE::TIME:
+                header.synchronized = *ptr++;
+                int64_t timestamp;
+                std::memcpy(&timestamp, ptr, sizeof(timestamp));
+                header.timestamp = be64toh(timestamp);
+                break;
+
+            case MESSAGE::LEADER:
+                header.synchronized = *ptr;
+                break;
+
+            default:
+                header.type = MESSAGE::ERROR;
+                break;
+        }
+
+        return header;
+    }
+}   // namespace legacy
+
+static uint8_t buffer[MAX_PACKET_SIZE];
+static uint8_t reference[MAX_PACKET_SIZE];
+
+// Prevent the compiler from optimizing away benchmarked results.
+template <typename T>
+static void keep(T const& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Run a function repeatedly and return nanoseconds per call.
+template <typename F>
+static double measure_calls(std::size_t rounds, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < rounds; ++r) {
+        f(r);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(rounds);
+}
+
+// Print a single comparison line.
+static void report(std::string const& name, double before, double after) {
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << before << " ns -> " << std::setw(8) << after << " ns  ("
+              << std::setprecision(1) << before / after << "x)\n";
+}
+
+// Legacy header carrying the fields of a message type.
+static legacy::MessageHeader legacy_header(MESSAGE type, MessageFields const& fields) {
+    legacy::MessageHeader header{};
+    header.type = type;
+
+    MessageLayout layout = get_layout(type);
+    if (layout.count.size > 0) {
+        header.count = fields.count;
+    }
+    if (layout.synchronized.size > 0) {
+        header.synchronized = fields.synchronized;
+    }
+    if (layout.timestamp.size > 0) {
+        header.timestamp = fields.timestamp;
+    }
+
+    return header;
+}
+
+// Encode with the codec for a type known at run time.
+static std::size_t encode_any(MESSAGE type, uint8_t* out, MessageFields const& fields) {
+    switch (type) {
+        case MESSAGE::HELLO:            return encode<MESSAGE::HELLO>(out, fields);
+        case MESSAGE::HELLO_REPLY:      return encode<MESSAGE::HELLO_REPLY>(out, fields);
+        case MESSAGE::CONNECT:          return encode<MESSAGE::CONNECT>(out, fields);
+        case MESSAGE::ACK_CONNECT:      return encode<MESSAGE::ACK_CONNECT>(out, fields);
+        case MESSAGE::SYNC_START:       return encode<MESSAGE::SYNC_START>(out, fields);
+        case MESSAGE::DELAY_REQUEST:    return encode<MESSAGE::DELAY_REQUEST>(out, fields);
+        case MESSAGE::DELAY_RESPONSE:   return encode<MESSAGE::DELAY_RESPONSE>(out, fields);
+        case MESSAGE::LEADER:           return encode<MESSAGE::LEADER>(out, fields);
+        case MESSAGE::GET_TIME:         return encode<MESSAGE::GET_TIME>(out, fields);
+        case MESSAGE::TIME:             return encode<MESSAGE::TIME>(out, fields);
+        default:                        return encode<MESSAGE::ERROR>(out, fields);
+    }
+}
+
+// Check that the codec writes the same bytes as the legacy serializer and
+// decodes random buffers to the same fields, and that newer messages and
+// peer records round-trip.
+static void check_codec() {
+    static const std::array<MESSAGE, 11> types = {
+        MESSAGE::HELLO, MESSAGE::HELLO_REPLY, MESSAGE::CONNECT, MESSAGE::ACK_CONNECT,
+        MESSAGE::SYNC_START, MESSAGE::DELAY_REQUEST, MESSAGE::DELAY_RESPONSE,
+        MESSAGE::LEADER, MESSAGE::GET_TIME, MESSAGE::TIME, MESSAGE::ERROR
+    };
+
+    std::mt19937_64 gen(2025);
+    std::size_t cases = 1000000, mismatches = 0;
+
+    auto check = [&](bool ok, std::string const& what) {
+        if (!ok && ++mismatches <= 10) {
+            err("codec mismatch: ", what);
+        }
+    };
+
+    for (std::size_t i = 0; i < cases; ++i) {
+        MESSAGE type = types[gen() % types.size()];
+        MessageFields fields{static_cast<uint16_t>(gen()), static_cast<uint8_t>(gen()),
+                             static_cast<int64_t>(gen()), static_cast<uint32_t>(gen()),
+                             static_cast<uint32_t>(gen())};
+
+        // Encoding.
+        legacy::serialize_header(legacy_header(type, fields), reference);
+        std::size_t size = encode_any(type, buffer, fields);
+        check(size == get_layout(type).size && std::memcmp(buffer, reference, size) == 0,
+              "encode of type " + std::to_string(static_cast<int>(type)));
+
+        // Decoding of random bytes.
+        for (std::size_t j = 0; j < SYNC_START_SIZE; ++j) {
+            buffer[j] = static_cast<uint8_t>(gen());
+        }
+        buffer[0] = static_cast<uint8_t>(type);
+        legacy::MessageHeader header = legacy::deserialize_header(buffer);
+        switch (type) {
+            case MESSAGE::HELLO_REPLY:
+                check(header.count == decode_count<MESSAGE::HELLO_REPLY>(buffer), "HELLO_REPLY count");
+                break;
+
+            case MESSAGE::SYNC_START:
+                check(header.synchronized == decode_synchronized<MESSAGE::SYNC_START>(buffer) &&
+                      header.timestamp == decode_timestamp<MESSAGE::SYNC_START>(buffer), "SYNC_START fields");
+                break;
+
+            case MESSAGE::DELAY_RESPONSE:
+                check(header.synchronized == decode_synchronized<MESSAGE::DELAY_RESPONSE>(buffer) &&
+                      header.timestamp == decode_timestamp<MESSAGE::DELAY_RESPONSE>(buffer),
+                      "DELAY_RESPONSE fields");
+                break;
+
+            case MESSAGE::TIME:
+                check(header.synchronized == decode_synchronized<MESSAGE::TIME>(buffer) &&
+                      header.timestamp == decode_timestamp<MESSAGE::TIME>(buffer), "TIME fields");
+                break;
+
+            case MESSAGE::LEADER:
+                check(header.synchronized == decode_synchronized<MESSAGE::LEADER>(buffer), "LEADER field");
+                break;
+
+            default:
+                break;
+        }
+
+        // Paged discovery messages, unknown to the legacy serializer, round-trip.
+        encode<MESSAGE::PEERS>(buffer, fields);
+        check(decode_cursor<MESSAGE::PEERS>(buffer) == fields.cursor &&
+              decode_count<MESSAGE::PEERS>(buffer) == fields.count &&
+              decode_request_cursor<MESSAGE::PEERS>(buffer) == fields.request_cursor, "PEERS fields");
+        encode<MESSAGE::PEERS_REQUEST>(buffer, fields);
+        check(decode_cursor<MESSAGE::PEERS_REQUEST>(buffer) == fields.cursor, "PEERS_REQUEST cursor");
+
+        // Peer records.
+        sockaddr_in peer{};
+        peer.sin_family = AF_INET;
+        peer.sin_addr.s_addr = static_cast<uint32_t>(gen());
+        peer.sin_port = static_cast<uint16_t>(gen());
+        sockaddr_in decoded;
+        encode_peer(buffer, peer);
+        check(decode_peer(buffer, decoded) && decoded.sin_addr.s_addr == peer.sin_addr.s_addr &&
+              decoded.sin_port == peer.sin_port, "peer record");
+
+        buffer[0] = static_cast<uint8_t>(gen() % 255 + 5);
+        check(!decode_peer(buffer, decoded), "non IPv4 peer record accepted");
+    }
+
+    std::cout << "codec check: " << cases << " random messages, " << mismatches << " mismatches\n";
+}
+
+// Compare the legacy serializer with the codec on the messages of a sync round.
+static void bench_codec() {
+    std::size_t rounds = 2000000;
+    MessageFields fields{0, 1, 123456789, 0, 0};
+
+    double legacy_encode = measure_calls(rounds / 20, [&](std::size_t r) {
+        legacy::MessageHeader header{};
+        header.type = MESSAGE::SYNC_START;
+        header.synchronized = fields.synchronized;
+        header.timestamp = static_cast<int64_t>(r);
+        legacy::serialize_header(header, buffer);
+        keep(buffer);
+    });
+    double codec_encode = measure_calls(rounds, [&](std::size_t r) {
+        fields.timestamp = static_cast<int64_t>(r);
+        keep(encode<MESSAGE::SYNC_START>(buffer, fields));
+        keep(buffer);
+    });
+    report("encode SYNC_START", legacy_encode, codec_encode);
+
+    // Decode a set of prebuilt messages, so no store is waited for.
+    static uint8_t messages[64][SYNC_START_SIZE];
+    for (std::size_t i = 0; i < 64; ++i) {
+        fields.timestamp = static_cast<int64_t>(i * 1000003);
+        encode<MESSAGE::SYNC_START>(messages[i], fields);
+    }
+
+    double legacy_decode = measure_calls(rounds, [&](std::size_t r) {
+        keep(legacy::deserialize_header(messages[r % 64]));
+    });
+    double codec_decode = measure_calls(rounds, [&](std::size_t r) {
+        keep(decode_synchronized<MESSAGE::SYNC_START>(messages[r % 64]));
+        keep(decode_timestamp<MESSAGE::SYNC_START>(messages[r % 64]));
+    });
+    report("decode SYNC_START", legacy_decode, codec_decode);
+}
+
+int main(int argc, char* argv[]) {
+    // Available benchmarks, all of them run if none is named.
+    std::vector<std::pair<std::string, std::function<void()>>> benches = {
+        {"codec", [] { check_codec(); bench_codec(); }},
+    };
+
+    for (auto const& [name, run] : benches) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            selected |= name == argv[i];
+        }
+
+        if (selected) {
+            std::cout << "== " << name << " ==\n";
+            run();
+        }
+    }
+}
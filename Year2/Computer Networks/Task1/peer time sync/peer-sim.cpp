@@ -0,0 +1,640 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+#include "node.h"
+#include "err.h"
+
+// Nodes get consecutive addresses from here on, all with the same port.
+constexpr uint32_t FIRST_NODE_ADDRESS = 0x0a000001;     // 10.0.0.1
+constexpr uint16_t NODE_PORT = 7000;
+constexpr std::size_t MAX_NODES = 1 << 20;
+
+// Address the LEADER message comes from, never a node.
+constexpr uint32_t CONTROLLER_ADDRESS = 0x0afffffe;     // 10.255.255.254
+
+// Simple struct to hold console parameters.
+struct SimConfig {
+    std::size_t nodes = 100;                    // Number of nodes.
+    double latency = 1.0;                       // Minimal one-way delay in milliseconds.
+    double jitter = 0.5;                        // Extra delay, uniform from 0 to this, in milliseconds.
+    double loss = 0.0;                          // Probability of losing a datagram.
+    int64_t duration = 60;                      // Simulated seconds after the leader is chosen.
+    double join_interval = 10.0;                // Milliseconds between starts of consecutive nodes.
+    std::optional<std::size_t> discovery_limit; // Paged discovery limit of joining nodes.
+    bool high_resolution = false;               // Nodes use microsecond timestamps.
+    std::size_t filter_window = OFFSET_FILTER_WINDOW;   // Exchanges nodes filter offsets over.
+    bool compare = false;                       // Run millisecond single exchange sync first, for reference.
+    uint64_t seed = 1;                          // Seed of the network's randomness.
+};
+
+// Offset errors of synchronized followers against the leader, in milliseconds.
+struct Accuracy {
+    double mean{};
+    double p50{};
+    double p99{};
+    double max{};
+};
+
+// Scheduled happening, times are virtual microseconds.
+struct Event {
+    enum Type { START, DATAGRAM, TIMER };
+
+    int64_t time;                   // When it happens.
+    Type type;
+    std::size_t node;               // Node it happens to.
+    sockaddr_in from;               // Sender of a datagram.
+    std::vector<uint8_t> data;      // Datagram.
+};
+
+// Heap entry of a scheduled event, small so that the heap mostly stays in cache.
+struct Pending {
+    int64_t time;
+    uint64_t seq;                   // Order of scheduling, breaks ties deterministically.
+    uint32_t slot;                  // Event in the slab.
+
+    // Later events have lower priority.
+    bool operator<(Pending const& other) const {
+        return time != other.time ? time > other.time : seq > other.seq;
+    }
+};
+
+// Single simulated node.
+struct SimNode {
+    NodeContext context;
+    int64_t start;                  // Start of its natural clock, clocks of nodes differ by it.
+    std::optional<int64_t> timer;   // Time of its scheduled timer event, others are stale.
+};
+
+// Counters of a message type.
+struct MessageStats {
+    uint64_t sent{};
+    uint64_t lost{};
+    uint64_t bytes{};
+};
+
+// Stream buffer swallowing what is written, counting lines.
+// Replaces std::cerr, which the handlers write message errors to.
+class LineCounter : public std::streambuf {
+    public:
+        uint64_t lines = 0;
+
+    protected:
+        int overflow(int c) override {
+            lines += c == '\n';
+            return c;
+        }
+
+        std::streamsize xsputn(char const* s, std::streamsize n) override {
+            lines += std::count(s, s + n, '\n');
+            return n;
+        }
+};
+
+// Virtual network and clock of all nodes.
+// Datagrams are delivered after latency and jitter, or lost, in a deterministic order.
+class Simulation : public Transport {
+    public:
+        explicit Simulation(SimConfig const& config);
+
+        // Run the nodes until the end of the simulated duration.
+        void run();
+
+        // Offset errors of the synchronized nodes at the end of the run.
+        Accuracy accuracy() const;
+
+        // Print the summary of the run.
+        void report(double wall_seconds, uint64_t error_lines) const;
+
+        bool send(NodeContext const& sender, uint8_t const* data, std::size_t size,
+                  sockaddr_in const& address) override;
+
+    private:
+        static sockaddr_in address_of(uint32_t address);
+        std::optional<std::size_t> node_of(sockaddr_in const& address) const;
+
+        void schedule(Event event);
+        void set_clock(SimNode& node);
+        void arm_timer(std::size_t index);
+        void dispatch(Event& event);
+        int64_t offset_error(SimNode const& node) const;
+
+        SimConfig const& config;
+        std::vector<SimNode> nodes;
+        std::vector<Pending> queue;         // Heap of scheduled events.
+        std::vector<Event> slab;            // Scheduled events, slots are reused once run.
+        std::vector<uint32_t> free_slots;   // Unused slots of the slab.
+        std::mt19937_64 gen;
+        int64_t now = 0;
+        uint64_t seq = 0;
+        uint64_t events = 0;
+
+        int64_t leader_at;                  // Time the leader is chosen.
+        std::size_t synced = 0;             // Nodes with a sync level below 255.
+        std::optional<int64_t> converged;   // First time all nodes were synced.
+        MessageStats stats[256];            // Counters by message type.
+};
+
+Simulation::Simulation(SimConfig const& config)
+    : config(config), nodes(config.nodes), gen(config.seed) {
+    std::uniform_int_distribution<int64_t> sub_ms(0, 999);
+
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        // Clocks start at unaligned microseconds, so rounding to milliseconds shows.
+        SimNode& node = nodes[i];
+        node.start = std::llround(static_cast<double>(i) * config.join_interval * 1000) + sub_ms(gen);
+
+        Config node_config{};
+        node_config.bind_address = address_of(FIRST_NODE_ADDRESS + i);
+        // Every node joins through a random node started before it.
+        if (i > 0) {
+            std::uniform_int_distribution<std::size_t> contact(0, i - 1);
+            node_config.peer_address = address_of(FIRST_NODE_ADDRESS + contact(gen));
+            node_config.discovery_limit = config.discovery_limit;
+        }
+        node_config.high_resolution = config.high_resolution;
+        node_config.filter_window = config.filter_window;
+
+        init_node(node.context, node_config);
+        node.context.transport = this;
+        node.context.my_socket = -1;
+
+        schedule(Event{node.start, Event::START, i, {}, {}});
+    }
+
+    // The first node becomes the leader once all nodes started.
+    leader_at = nodes.back().start + 1000;
+
+    Event leader{leader_at, Event::DATAGRAM, 0, address_of(CONTROLLER_ADDRESS),
+                 std::vector<uint8_t>(LEADER_SIZE)};
+    MessageFields fields{};
+    fields.synchronized = 0;
+    encode<MESSAGE::LEADER>(leader.data.data(), fields);
+    schedule(std::move(leader));
+}
+
+// Address of a node or the controller.
+sockaddr_in Simulation::address_of(uint32_t address) {
+    sockaddr_in result{};
+    result.sin_family = AF_INET;
+    result.sin_addr.s_addr = htonl(address);
+    result.sin_port = htons(NODE_PORT);
+    return result;
+}
+
+// Index of the node with an address, if any.
+std::optional<std::size_t> Simulation::node_of(sockaddr_in const& address) const {
+    uint32_t host = ntohl(address.sin_addr.s_addr);
+    if (ntohs(address.sin_port) != NODE_PORT || host < FIRST_NODE_ADDRESS ||
+        host - FIRST_NODE_ADDRESS >= nodes.size()) {
+        return std::nullopt;
+    }
+
+    return host - FIRST_NODE_ADDRESS;
+}
+
+void Simulation::schedule(Event event) {
+    uint32_t slot = slab.size();
+    if (free_slots.empty()) {
+        slab.push_back(std::move(event));
+    } else {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        slab[slot] = std::move(event);
+    }
+
+    queue.push_back(Pending{slab[slot].time, seq++, slot});
+    std::push_heap(queue.begin(), queue.end());
+}
+
+// Put the network in the path of a datagram.
+bool Simulation::send(NodeContext const& sender, uint8_t const* data, std::size_t size,
+                      sockaddr_in const& address) {
+    MessageStats& type_stats = stats[data[0]];
+    ++type_stats.sent;
+    type_stats.bytes += size;
+
+    std::optional<std::size_t> to = node_of(address);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    if (!to.has_value() || unit(gen) < config.loss) {
+        ++type_stats.lost;
+        return true;
+    }
+
+    double delay = config.latency + config.jitter * unit(gen);
+    schedule(Event{now + std::llround(delay * 1000), Event::DATAGRAM, to.value(),
+                   sender.config.bind_address, std::vector<uint8_t>(data, data + size)});
+    return true;
+}
+
+// Show the node its natural time since its start.
+void Simulation::set_clock(SimNode& node) {
+    node.context.natural_clock.set_time_us(now - node.start);
+}
+
+// Schedule the earliest protocol timer of a node.
+void Simulation::arm_timer(std::size_t index) {
+    SimNode& node = nodes[index];
+    std::optional<int64_t> deadline;
+    for (auto next : {sync_sending_deadline(node.context), sync_loss_deadline(node.context),
+                      sync_timeout_deadline(node.context), discovery_deadline(node.context)}) {
+        if (next.has_value() && (!deadline.has_value() || next.value() < deadline.value())) {
+            deadline = next;
+        }
+    }
+
+    if (!deadline.has_value()) {
+        node.timer = std::nullopt;
+        return;
+    }
+
+    int64_t time = std::max(now, node.start + deadline.value() * 1000);
+    if (node.timer != time) {
+        node.timer = time;
+        schedule(Event{time, Event::TIMER, index, {}, {}});
+    }
+}
+
+// Run the node code an event stands for.
+void Simulation::dispatch(Event& event) {
+    SimNode& node = nodes[event.node];
+    bool was_synced = node.context.synchronized != 255;
+
+    // Nodes can't receive before they start.
+    if (now < node.start) {
+        ++stats[event.data[0]].lost;
+        return;
+    }
+
+    set_clock(node);
+    switch (event.type) {
+        case Event::START:
+            join(node.context);
+            break;
+
+        case Event::DATAGRAM:
+            std::memcpy(buffer, event.data.data(), event.data.size());
+            handle_message(node.context, &event.from, event.data.size(), natural_timestamp(node.context));
+            break;
+
+        case Event::TIMER:
+            if (node.timer != event.time) {
+                return;
+            }
+            node.timer = std::nullopt;
+            process_timers(node.context);
+            break;
+    }
+
+    arm_timer(event.node);
+
+    bool is_synced = node.context.synchronized != 255;
+    synced += is_synced;
+    synced -= was_synced;
+    if (synced == nodes.size() && !converged.has_value()) {
+        converged = now;
+    }
+}
+
+// Run the nodes until the end of the simulated duration.
+void Simulation::run() {
+    int64_t end = leader_at + config.duration * 1000000;
+
+    while (!queue.empty() && queue.front().time <= end) {
+        std::pop_heap(queue.begin(), queue.end());
+        uint32_t slot = queue.back().slot;
+        queue.pop_back();
+
+        // Handlers schedule more events, which may move the slab.
+        Event event = std::move(slab[slot]);
+        free_slots.push_back(slot);
+
+        now = event.time;
+        ++events;
+        dispatch(event);
+    }
+
+    now = end;
+}
+
+// Difference between a node's synchronized time and the leader's, in microseconds.
+// Both clocks run at the same rate, so it stays put between syncs.
+int64_t Simulation::offset_error(SimNode const& node) const {
+    int64_t offset = node.context.offset * (config.high_resolution ? 1 : 1000);
+    return nodes[0].start - node.start - offset;
+}
+
+// Offset errors of the synchronized nodes at the end of the run.
+Accuracy Simulation::accuracy() const {
+    std::vector<int64_t> errors;
+    for (std::size_t i = 1; i < nodes.size(); ++i) {
+        if (nodes[i].context.synchronized != 255) {
+            errors.push_back(std::abs(offset_error(nodes[i])));
+        }
+    }
+
+    Accuracy result{};
+    if (errors.empty()) {
+        return result;
+    }
+    std::sort(errors.begin(), errors.end());
+
+    auto percentile = [&](double p) {
+        std::size_t index = std::min(errors.size() - 1, static_cast<std::size_t>(p * errors.size()));
+        return static_cast<double>(errors[index]) / 1000.0;
+    };
+
+    for (int64_t error : errors) {
+        result.mean += static_cast<double>(error) / 1000.0;
+    }
+    result.mean /= errors.size();
+    result.p50 = percentile(0.5);
+    result.p99 = percentile(0.99);
+    result.max = percentile(1.0);
+
+    return result;
+}
+
+// Print the summary of the run.
+void Simulation::report(double wall_seconds, uint64_t error_lines) const {
+    static const std::pair<MESSAGE, char const*> names[] = {
+        {MESSAGE::HELLO, "HELLO"}, {MESSAGE::HELLO_REPLY, "HELLO_REPLY"},
+        {MESSAGE::CONNECT, "CONNECT"}, {MESSAGE::ACK_CONNECT, "ACK_CONNECT"},
+        {MESSAGE::PEERS_REQUEST, "PEERS_REQUEST"}, {MESSAGE::PEERS, "PEERS"},
+        {MESSAGE::SYNC_START, "SYNC_START"}, {MESSAGE::DELAY_REQUEST, "DELAY_REQUEST"},
+        {MESSAGE::DELAY_RESPONSE, "DELAY_RESPONSE"}, {MESSAGE::LEADER, "LEADER"},
+        {MESSAGE::GET_TIME, "GET_TIME"}, {MESSAGE::TIME, "TIME"}
+    };
+
+    // Levels of all nodes.
+    std::vector<std::size_t> levels(256);
+    for (SimNode const& node : nodes) {
+        ++levels[node.context.synchronized];
+    }
+    Accuracy errors = accuracy();
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "simulated:    " << static_cast<double>(now) / 1e6 << " s ("
+              << config.duration << " s after the leader)\n"
+              << "wall time:    " << wall_seconds << " s (" << static_cast<double>(events) / wall_seconds
+              << " events/s)\n"
+              << "events:       " << events << "\n"
+              << "converged:    ";
+    if (converged.has_value()) {
+        std::cout << static_cast<double>(converged.value() - leader_at) / 1e6 << " s after the leader\n";
+    } else {
+        std::cout << "no\n";
+    }
+
+    std::cout << "synced:       " << synced << " of " << nodes.size() << ", levels";
+    for (std::size_t level = 0; level < levels.size(); ++level) {
+        if (levels[level] > 0) {
+            std::cout << " " << level << ":" << levels[level];
+        }
+    }
+
+    std::cout << "\noffset error: mean " << errors.mean << " ms, p50 " << errors.p50
+              << " ms, p99 " << errors.p99 << " ms, max " << errors.max << " ms\n"
+              << "message errors: " << error_lines << "\n"
+              << std::left << std::setw(16) << "message" << std::right << std::setw(12) << "sent"
+              << std::setw(12) << "lost" << std::setw(14) << "bytes" << "\n";
+
+    uint64_t sent = 0, lost = 0, bytes = 0;
+    for (auto const& [type, name] : names) {
+        MessageStats const& type_stats = stats[static_cast<uint8_t>(type)];
+        if (type_stats.sent > 0) {
+            std::cout << std::left << std::setw(16) << name << std::right << std::setw(12) << type_stats.sent
+                      << std::setw(12) << type_stats.lost << std::setw(14) << type_stats.bytes << "\n";
+        }
+        sent += type_stats.sent;
+        lost += type_stats.lost;
+        bytes += type_stats.bytes;
+    }
+    std::cout << std::left << std::setw(16) << "total" << std::right << std::setw(12) << sent
+              << std::setw(12) << lost << std::setw(14) << bytes << "\n";
+}
+
+// Print the usage message and exit the program.
+[[noreturn]] static void print_usage(char* progname) {
+    fatal("Usage: ", progname, " [-n <nodes>] [-l <latency_ms>] [-j <jitter_ms>] [-x <loss>]",
+          " [-t <seconds>] [-i <join_interval_ms>] [-g <max_peers>] [-u] [-w <window>] [-c] [-s <seed>]");
+}
+
+// Parse the program parameters.
+static SimConfig parse_args(int argc, char* argv[]) {
+    SimConfig config{};
+
+    bool given_n = false, given_l = false, given_j = false, given_x = false, given_t = false,
+         given_i = false, given_g = false, given_u = false, given_w = false, given_c = false,
+         given_s = false;
+
+    opterr = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:j:x:t:i:g:uw:cs:")) != -1) {
+        try {
+            switch (opt) {
+                case 'n':
+                    if (given_n) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.nodes = std::stoul(optarg);
+                    if (config.nodes < 1 || config.nodes > MAX_NODES) {
+                        fatal("Number of nodes must be between 1 and ", MAX_NODES);
+                    }
+
+                    given_n = true;
+                    break;
+
+                case 'l':
+                    if (given_l) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.latency = std::stod(optarg);
+                    if (config.latency < 0) {
+                        fatal("Latency must not be negative");
+                    }
+
+                    given_l = true;
+                    break;
+
+                case 'j':
+                    if (given_j) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.jitter = std::stod(optarg);
+                    if (config.jitter < 0) {
+                        fatal("Jitter must not be negative");
+                    }
+
+                    given_j = true;
+                    break;
+
+                case 'x':
+                    if (given_x) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.loss = std::stod(optarg);
+                    if (config.loss < 0 || config.loss > 1) {
+                        fatal("Loss must be between 0 and 1");
+                    }
+
+                    given_x = true;
+                    break;
+
+                case 't':
+                    if (given_t) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.duration = std::stol(optarg);
+                    if (config.duration < 1) {
+                        fatal("Duration must be positive");
+                    }
+
+                    given_t = true;
+                    break;
+
+                case 'i':
+                    if (given_i) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.join_interval = std::stod(optarg);
+                    if (config.join_interval < 0) {
+                        fatal("Join interval must not be negative");
+                    }
+
+                    given_i = true;
+                    break;
+
+                case 'g':
+                    if (given_g) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.discovery_limit = std::stoul(optarg);
+                    given_g = true;
+                    break;
+
+                case 'u':
+                    if (given_u) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.high_resolution = true;
+                    given_u = true;
+                    break;
+
+                case 'w':
+                    if (given_w) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.filter_window = std::stoul(optarg);
+                    if (config.filter_window < 1 || config.filter_window > MAX_OFFSET_FILTER_WINDOW) {
+                        fatal("Filter window must be between 1 and ", MAX_OFFSET_FILTER_WINDOW);
+                    }
+
+                    given_w = true;
+                    break;
+
+                case 'c':
+                    if (given_c) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.compare = true;
+                    given_c = true;
+                    break;
+
+                case 's':
+                    if (given_s) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.seed = std::stoull(optarg);
+                    given_s = true;
+                    break;
+
+                default:
+                    print_usage(argv[0]);
+            }
+        } catch (std::exception const&) {
+            fatal("Invalid argument for option:", std::string(1, static_cast<char>(opt)));
+        }
+    }
+
+    if (optind < argc) {
+        fatal("Unexpected positional argument: ", argv[optind]);
+    }
+
+    return config;
+}
+
+// Run and report a simulation, returning its accuracy.
+static Accuracy simulate(SimConfig const& config) {
+    std::cout << std::defaultfloat << "Simulating " << config.nodes << " nodes, latency " << config.latency << " ms, jitter "
+              << config.jitter << " ms, loss " << config.loss << ", discovery ";
+    if (config.discovery_limit.has_value()) {
+        std::cout << "paged, limit " << config.discovery_limit.value();
+    } else {
+        std::cout << "HELLO";
+    }
+    std::cout << ", " << (config.high_resolution ? "us" : "ms") << " timestamps, filter window "
+              << config.filter_window << ", seed " << config.seed << "\n";
+
+    Simulation simulation(config);
+
+    // Handlers report rejected messages on std::cerr, only their number is of interest.
+    LineCounter errors;
+    std::streambuf* cerr_buffer = std::cerr.rdbuf(&errors);
+
+    auto start = std::chrono::steady_clock::now();
+    simulation.run();
+    auto end = std::chrono::steady_clock::now();
+
+    std::cerr.rdbuf(cerr_buffer);
+    simulation.report(std::chrono::duration<double>(end - start).count(), errors.lines);
+
+    return simulation.accuracy();
+}
+
+int main(int argc, char* argv[]) {
+    SimConfig config = parse_args(argc, argv);
+
+    if (!config.compare) {
+        simulate(config);
+        return 0;
+    }
+
+    // The same network with the original estimator, one millisecond exchange.
+    SimConfig reference = config;
+    reference.high_resolution = false;
+    reference.filter_window = 1;
+
+    Accuracy before = simulate(reference);
+    std::cout << "\n";
+    Accuracy after = simulate(config);
+
+    auto gain = [](double before, double after) {
+        return after > 0 ? before / after : 0.0;
+    };
+    std::cout << std::fixed << std::setprecision(1)
+              << "\naccuracy gain: mean " << gain(before.mean, after.mean) << "x, p99 "
+              << gain(before.p99, after.p99) << "x, max " << gain(before.max, after.max) << "x\n";
+}
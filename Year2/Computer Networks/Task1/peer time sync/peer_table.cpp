@@ -0,0 +1,96 @@
+#include "peer_table.h"
+
+#include <bit>
+
+#include "detail.h"
+
+namespace {
+    constexpr std::size_t INITIAL_SLOTS = 64;
+
+    // Hash of an address and port, multiplicative hashing keeps the high bits.
+    uint64_t hash_address(sockaddr_in const& address) {
+        uint64_t key = (static_cast<uint64_t>(address.sin_addr.s_addr) << 16) | address.sin_port;
+        return key * 0x9e3779b97f4a7c15;
+    }
+}   // namespace
+
+PeerTable::PeerTable() : slots(INITIAL_SLOTS), used(0) {}
+
+// Record of an address, nullptr if there is none.
+Peer* PeerTable::find(sockaddr_in const& address) {
+    Peer& peer = slots[slot_of(address)];
+    return peer.address.sin_family == AF_UNSPEC ? nullptr : &peer;
+}
+
+// Record of an address, added with no flags set if there is none.
+Peer& PeerTable::insert(sockaddr_in const& address) {
+    std::size_t slot = slot_of(address);
+    if (slots[slot].address.sin_family != AF_UNSPEC) {
+        return slots[slot];
+    }
+
+    if (2 * (used + 1) > slots.size()) {
+        grow();
+        slot = slot_of(address);
+    }
+
+    Peer& peer = slots[slot];
+    peer = Peer{};
+    peer.address.sin_family = AF_INET;
+    peer.address.sin_addr = address.sin_addr;
+    peer.address.sin_port = address.sin_port;
+    peer.sync_attempt_to = -1;
+    ++used;
+
+    return peer;
+}
+
+// Mark a peer as connected, appending it to the connected peers.
+void PeerTable::connect(Peer& peer) {
+    if (!peer.connected) {
+        peer.connected = true;
+        connected.push_back(peer.address);
+    }
+}
+
+// Number of connected peers.
+std::size_t PeerTable::connected_size() const {
+    return connected.size();
+}
+
+// Addresses of connected peers in the order they connected.
+std::vector<sockaddr_in> const& PeerTable::connected_peers() const {
+    return connected;
+}
+
+// Clear the pending flag of every peer.
+void PeerTable::clear_pending() {
+    for_each([](Peer& peer) {
+        peer.pending = false;
+    });
+}
+
+// Slot holding the address, or the empty slot where it would go.
+std::size_t PeerTable::slot_of(sockaddr_in const& address) const {
+    std::size_t mask = slots.size() - 1;
+    std::size_t slot = hash_address(address) >> (64 - std::countr_zero(slots.size()));
+
+    while (slots[slot].address.sin_family != AF_UNSPEC &&
+           !detail::is_same_sockaddr_in(slots[slot].address, address)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+// Double the number of slots and move all records.
+void PeerTable::grow() {
+    std::vector<Peer> old(slots.size() * 2);
+    old.swap(slots);
+
+    for (Peer const& peer : old) {
+        if (peer.address.sin_family != AF_UNSPEC) {
+            slots[slot_of(peer.address)] = peer;
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef PEER_PEER_TABLE_H
+#define PEER_PEER_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <netinet/in.h>
+
+// Everything the node keeps about a single (address, port).
+// Records are 32 bytes and aligned to that, so each lies in one cache line.
+struct alignas(32) Peer {
+    sockaddr_in address;                // Key, sin_family is AF_UNSPEC in empty slots.
+    int64_t sync_attempt_to;            // Last SYNC_START we sent to the peer, -1 if none.
+    bool connected;                     // Known peer.
+    bool pending;                       // Awaiting connection confirmation.
+    bool delay_request_received;        // Received DELAY_REQUEST during this syncing process.
+};
+
+// Open-addressing hash table of peers keyed by address and port, with linear probing.
+// Records are never removed, the node only clears their flags.
+class PeerTable {
+    public:
+        PeerTable();
+
+        // Record of an address, nullptr if there is none.
+        Peer* find(sockaddr_in const& address);
+
+        // Record of an address, added with no flags set if there is none.
+        // References to records are invalidated by adding new ones.
+        Peer& insert(sockaddr_in const& address);
+
+        // Mark a peer as connected, appending it to the connected peers.
+        void connect(Peer& peer);
+
+        // Number of connected peers.
+        std::size_t connected_size() const;
+
+        // Addresses of connected peers in the order they connected.
+        // Peers are never disconnected, so positions are stable, which pages of peers rely on.
+        std::vector<sockaddr_in> const& connected_peers() const;
+
+        // Clear the pending flag of every peer.
+        void clear_pending();
+
+        // Call f on every record.
+        template <typename F>
+        void for_each(F&& f) {
+            for (Peer& peer : slots) {
+                if (peer.address.sin_family != AF_UNSPEC) {
+                    f(peer);
+                }
+            }
+        }
+
+    private:
+        std::size_t slot_of(sockaddr_in const& address) const;
+        void grow();
+
+        std::vector<Peer> slots;        // Power of two size, at most half full.
+        std::size_t used;               // Number of records.
+        std::vector<sockaddr_in> connected;     // Connected peers in the order they connected.
+};
+
+#endif // PEER_PEER_TABLE_H
@@ -1,19 +1,24 @@
 #ifndef PEER_PROTOCOL_H
 #define PEER_PROTOCOL_H
 
+#include <cstddef>
 #include <cstdint>
-#include <optional>
+#include <cstring>
+#include <endian.h>
+#include <netinet/in.h>
 
 // General constants.
 constexpr std::size_t MAX_ADDRESS_LENGTH = 4;
 constexpr std::size_t MAX_PACKET_SIZE = 65507;
 
 // Message sizes.
-// Doesn't include HELLO_REPLY's variable size.
+// Doesn't include HELLO_REPLY's and PEERS' variable size.
 constexpr std::size_t HELLO_SIZE = 1;
 constexpr std::size_t HELLO_REPLY_SIZE = 3;
 constexpr std::size_t CONNECT_SIZE = 1;
 constexpr std::size_t ACK_CONNECT_SIZE = 1;
+constexpr std::size_t PEERS_REQUEST_SIZE = 5;
+constexpr std::size_t PEERS_SIZE = 11;
 constexpr std::size_t SYNC_START_SIZE = 10;
 constexpr std::size_t DELAY_REQUEST_SIZE = 1;
 constexpr std::size_t DELAY_RESPONSE_SIZE = 10;
@@ -29,6 +34,8 @@ enum class MESSAGE : uint8_t {
     HELLO_REPLY = 2,
     CONNECT = 3,
     ACK_CONNECT = 4,
+    PEERS_REQUEST = 5,
+    PEERS = 6,
 
     // Synchronization.
     SYNC_START = 11,
@@ -54,6 +61,8 @@ constexpr std::size_t get_message_size(MESSAGE type) {
         case MESSAGE::HELLO_REPLY:     return HELLO_REPLY_SIZE;
         case MESSAGE::CONNECT:         return CONNECT_SIZE;
         case MESSAGE::ACK_CONNECT:     return ACK_CONNECT_SIZE;
+        case MESSAGE::PEERS_REQUEST:   return PEERS_REQUEST_SIZE;
+        case MESSAGE::PEERS:           return PEERS_SIZE;
         case MESSAGE::SYNC_START:      return SYNC_START_SIZE;
         case MESSAGE::DELAY_REQUEST:   return DELAY_REQUEST_SIZE;
         case MESSAGE::DELAY_RESPONSE:  return DELAY_RESPONSE_SIZE;
@@ -65,18 +74,149 @@ constexpr std::size_t get_message_size(MESSAGE type) {
     }
 }
 
-// Message header structure.
-struct MessageHeader {
-    MESSAGE type;
-    std::optional<uint16_t> count;
-    std::optional<uint8_t> synchronized;
-    std::optional<int64_t> timestamp;
+// Position of a field in a message, size 0 if the message doesn't carry it.
+struct FieldLayout {
+    std::size_t offset;
+    std::size_t size;
 };
 
-// Function to serialize the message header into a buffer.
-void serialize_header(MessageHeader const& header, uint8_t* buffer);
+// Wire layout of a message: the type byte followed by its fields, big endian.
+struct MessageLayout {
+    std::size_t size;
+    FieldLayout count;
+    FieldLayout synchronized;
+    FieldLayout timestamp;
+    FieldLayout cursor;
+    FieldLayout request_cursor;
+};
+
+// Layout of a message type.
+// HELLO_REPLY's and PEERS' sizes don't include their peer records.
+constexpr MessageLayout get_layout(MESSAGE type) {
+    switch (type) {
+        case MESSAGE::HELLO_REPLY:
+            return {HELLO_REPLY_SIZE, {1, 2}, {}, {}, {}, {}};
+
+        case MESSAGE::PEERS_REQUEST:
+            return {PEERS_REQUEST_SIZE, {}, {}, {}, {1, 4}, {}};
+
+        case MESSAGE::PEERS:
+            return {PEERS_SIZE, {5, 2}, {}, {}, {1, 4}, {7, 4}};
+
+        case MESSAGE::SYNC_START:
+        case MESSAGE::DELAY_RESPONSE:
+        case MESSAGE::TIME:
+            return {SYNC_START_SIZE, {}, {1, 1}, {2, 8}, {}, {}};
+
+        case MESSAGE::LEADER:
+            return {LEADER_SIZE, {}, {1, 1}, {}, {}, {}};
+
+        default:
+            return {1, {}, {}, {}, {}, {}};
+    }
+}
+
+// Values of message fields, those a message doesn't carry are ignored.
+struct MessageFields {
+    uint16_t count;
+    uint8_t synchronized;
+    int64_t timestamp;
+    uint32_t cursor;            // Position in the sender's list of connected peers.
+    uint32_t request_cursor;    // Cursor of the PEERS_REQUEST a PEERS answers.
+};
+
+// Encode a message of given type at the start of buffer and return its size.
+// Only the message's bytes are written, the layout decides which fields at compile time.
+template <MESSAGE Type>
+std::size_t encode(uint8_t* buffer, MessageFields const& fields = {}) {
+    constexpr MessageLayout layout = get_layout(Type);
+    static_assert(Type == MESSAGE::HELLO_REPLY || layout.size == get_message_size(Type));
+
+    buffer[0] = static_cast<uint8_t>(Type);
+
+    if constexpr (layout.count.size > 0) {
+        uint16_t count = htobe16(fields.count);
+        std::memcpy(buffer + layout.count.offset, &count, sizeof(count));
+    }
+
+    if constexpr (layout.synchronized.size > 0) {
+        buffer[layout.synchronized.offset] = fields.synchronized;
+    }
+
+    if constexpr (layout.timestamp.size > 0) {
+        uint64_t timestamp = htobe64(static_cast<uint64_t>(fields.timestamp));
+        std::memcpy(buffer + layout.timestamp.offset, &timestamp, sizeof(timestamp));
+    }
+
+    if constexpr (layout.cursor.size > 0) {
+        uint32_t cursor = htobe32(fields.cursor);
+        std::memcpy(buffer + layout.cursor.offset, &cursor, sizeof(cursor));
+    }
+
+    if constexpr (layout.request_cursor.size > 0) {
+        uint32_t request_cursor = htobe32(fields.request_cursor);
+        std::memcpy(buffer + layout.request_cursor.offset, &request_cursor, sizeof(request_cursor));
+    }
+
+    return layout.size;
+}
+
+// Decode single fields of a message of given type, the message must carry them.
+template <MESSAGE Type>
+uint16_t decode_count(uint8_t const* buffer) {
+    constexpr FieldLayout field = get_layout(Type).count;
+    static_assert(field.size == sizeof(uint16_t));
+
+    uint16_t count;
+    std::memcpy(&count, buffer + field.offset, sizeof(count));
+    return be16toh(count);
+}
+
+template <MESSAGE Type>
+uint8_t decode_synchronized(uint8_t const* buffer) {
+    constexpr FieldLayout field = get_layout(Type).synchronized;
+    static_assert(field.size == sizeof(uint8_t));
+
+    return buffer[field.offset];
+}
+
+template <MESSAGE Type>
+int64_t decode_timestamp(uint8_t const* buffer) {
+    constexpr FieldLayout field = get_layout(Type).timestamp;
+    static_assert(field.size == sizeof(int64_t));
+
+    uint64_t timestamp;
+    std::memcpy(&timestamp, buffer + field.offset, sizeof(timestamp));
+    return static_cast<int64_t>(be64toh(timestamp));
+}
+
+template <MESSAGE Type>
+uint32_t decode_cursor(uint8_t const* buffer) {
+    constexpr FieldLayout field = get_layout(Type).cursor;
+    static_assert(field.size == sizeof(uint32_t));
+
+    uint32_t cursor;
+    std::memcpy(&cursor, buffer + field.offset, sizeof(cursor));
+    return be32toh(cursor);
+}
+
+template <MESSAGE Type>
+uint32_t decode_request_cursor(uint8_t const* buffer) {
+    constexpr FieldLayout field = get_layout(Type).request_cursor;
+    static_assert(field.size == sizeof(uint32_t));
+
+    uint32_t cursor;
+    std::memcpy(&cursor, buffer + field.offset, sizeof(cursor));
+    return be32toh(cursor);
+}
+
+// Peer record of HELLO_REPLY and PEERS: address length, IPv4 address and port.
+constexpr std::size_t PEER_RECORD_SIZE = 1 + MAX_ADDRESS_LENGTH + sizeof(uint16_t);
+
+// Encode a peer record at ptr.
+void encode_peer(uint8_t* ptr, sockaddr_in const& peer);
 
-// Function to deserialize the message header from a buffer.
-MessageHeader deserialize_header(uint8_t const* buffer);
+// Decode a peer record at ptr, false if its address is not IPv4.
+bool decode_peer(uint8_t const* ptr, sockaddr_in& peer);
 
-#endif // PEER_PROTOCOL_H
\ No newline at end of file
+#endif // PEER_PROTOCOL_H
@@ -0,0 +1,488 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <cstring>
+#include <cmath>
+
+#include "protocol.h"
+#include "binary.h"
+#include "detail.h"
+#include "err.h"
+
+// Previous regex and stream based implementation of the protocol parser,
+// kept as the reference the scanner is checked and measured against.
+namespace legacy {
+    bool validate_hello(std::string const& line) {
+        static const std::regex pattern(R"(^HELLO [a-zA-Z0-9]+$)");
+        return std::regex_match(line, pattern);
+    }
+
+    bool validate_coeff(std::string const& line) {
+        static const std::regex pattern(R"(^COEFF( -?\d+(\.\d{0,7})?)+$)");
+        return std::regex_match(line, pattern);
+    }
+
+    bool validate_put(std::string const& line) {
+        static const std::regex pattern(R"(^PUT \d+ -?\d+(\.\d{0,7})?$)");
+        return std::regex_match(line, pattern);
+    }
+
+    bool validate_penalty(std::string const& line) {
+        static const std::regex pattern(R"(^PENALTY \d+ -?\d+(\.\d{0,7})?$)");
+        return std::regex_match(line, pattern);
+    }
+
+    bool validate_state(std::string const& line) {
+        static const std::regex pattern(R"(^STATE( -?\d+(\.\d{0,7})?)+$)");
+        return std::regex_match(line, pattern);
+    }
+
+    bool validate_scoring(std::string const& line) {
+        static const std::regex pattern(R"(^SCORING ([a-zA-Z0-9]+ \d+(\.\d{0,7})?)+$)");
+        return std::regex_match(line, pattern);
+    }
+
+    std::pair<int16_t, double> parse_put(std::string const& line) {
+        std::istringstream iss(line.substr(PUT_SIZE));
+        std::pair<int16_t, double> res;
+        iss >> res.first >> res.second;
+        return res;
+    }
+
+    std::vector<double> parse_state(std::string const& line) {
+        std::istringstream iss(line.substr(STATE_SIZE));
+        std::vector<double> values;
+        double val;
+
+        while (iss >> val) {
+            values.push_back(val);
+        }
+
+        return values;
+    }
+
+    std::vector<std::pair<std::string, double>> parse_scoring(std::string const& line) {
+        std::istringstream iss(line.substr(SCORING_SIZE));
+
+        std::vector<std::pair<std::string, double>> scoring;
+        std::string player_id;
+        double score;
+        while (iss >> player_id >> score) {
+            scoring.emplace_back(player_id, score);
+        }
+
+        return scoring;
+    }
+
+    std::string build_state(std::vector<double> const& values) {
+        std::ostringstream oss;
+        oss << "STATE";
+
+        for (const auto& val : values) {
+            oss << " " << std::fixed << std::setprecision(7) << val;
+        }
+
+        oss << DELIMITER;
+        return oss.str();
+    }
+}   // namespace legacy
+
+// Prevent the compiler from optimizing away benchmarked results.
+template <typename T>
+static void keep(T const& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Run a function over all inputs repeatedly and return nanoseconds per call.
+template <typename F>
+static double measure(std::vector<std::string> const& inputs, std::size_t rounds, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < rounds; ++r) {
+        for (auto const& input : inputs) {
+            f(input);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / static_cast<double>(rounds * inputs.size());
+}
+
+// Print a single comparison line.
+static void report(std::string const& name, double before, double after) {
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << before << " ns -> " << std::setw(8) << after << " ns  ("
+              << std::setprecision(1) << before / after << "x)\n";
+}
+
+// Random line over an alphabet that hits the interesting parts of the grammar.
+static std::string random_line(std::mt19937& gen) {
+    static const std::vector<std::string> prefixes = {
+        "PUT ", "PUT", "STATE", "STATE ", "COEFF", "COEFF ", "SCORING ", "HELLO ", "PENALTY ", ""
+    };
+    static const std::string alphabet = "0123456789012345678901234567890123456789 -.aZ\r\t";
+
+    std::string line = prefixes[gen() % prefixes.size()];
+    std::size_t length = gen() % 24;
+    for (std::size_t i = 0; i < length; ++i) {
+        line += alphabet[gen() % alphabet.size()];
+    }
+
+    return line;
+}
+
+// Check that the scanner accepts exactly the lines the regexes accept
+// and parses them to the same values.
+static void check_scanner() {
+    std::mt19937 gen(2024);
+    std::size_t lines = 200000, accepted = 0, mismatches = 0;
+
+    auto check = [&](std::string const& line, bool expected, bool actual) {
+        if (expected != actual) {
+            if (++mismatches <= 10) {
+                err("scanner mismatch on \"", line, "\": regex ", expected, ", scanner ", actual);
+            }
+        }
+        accepted += expected;
+    };
+
+    for (std::size_t i = 0; i < lines; ++i) {
+        std::string line = random_line(gen);
+
+        check(line, legacy::validate_hello(line), scan_hello(line).has_value());
+        check(line, legacy::validate_coeff(line), scan_coeff(line).has_value());
+        check(line, legacy::validate_penalty(line), scan_penalty(line).has_value());
+        check(line, legacy::validate_scoring(line), scan_scoring(line).has_value());
+
+        auto put = scan_put(line);
+        check(line, legacy::validate_put(line), put.has_value());
+        if (put.has_value() && put->first < INT16_MAX && legacy::parse_put(line) != put.value()) {
+            check(line + " (value)", true, false);
+        }
+
+        auto state = scan_state(line);
+        check(line, legacy::validate_state(line), state.has_value());
+        if (state.has_value() && legacy::parse_state(line) != state.value()) {
+            check(line + " (value)", true, false);
+        }
+
+        auto scoring = scan_scoring(line);
+        if (scoring.has_value() && legacy::parse_scoring(line) != scoring.value()) {
+            check(line + " (value)", true, false);
+        }
+    }
+
+    // Session options, the suffixes are also valid player ids on their own.
+    struct HelloCase {
+        std::string line;
+        std::optional<std::string_view> id;
+        HelloOptions options;
+    };
+    std::vector<HelloCase> hellos = {
+        {"HELLO DELTA", "DELTA", {}},
+        {"HELLO BINARY", "BINARY", {}},
+        {"HELLO BINARY DELTA", "BINARY", {.binary = false, .delta = true}},
+        {"HELLO DELTA BINARY", "DELTA", {.binary = true, .delta = false}},
+        {"HELLO a BINARY DELTA", "a", {.binary = true, .delta = true}},
+        {"HELLO a DELTA", "a", {.binary = false, .delta = true}},
+        {"HELLO  DELTA", std::nullopt, {}},
+        {"HELLO DELTA DELTA", "DELTA", {.binary = false, .delta = true}},
+    };
+    for (auto const& hello : hellos) {
+        HelloOptions options;
+        auto id = scan_hello(hello.line, options);
+        bool matches = id == hello.id && (!id.has_value() ||
+                       (options.binary == hello.options.binary && options.delta == hello.options.delta));
+        if (!matches && ++mismatches <= 10) {
+            err("scanner mismatch on \"", hello.line, "\" options");
+        }
+    }
+
+    std::cout << "scanner check: " << lines << " random lines, " << accepted
+              << " accepted by regex, " << mismatches << " mismatches\n";
+}
+
+// Compare the regex and stream path with the single pass scanner.
+static void bench_scanner() {
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> dist(-5.0, 5.0);
+
+    std::vector<std::string> puts;
+    for (int i = 0; i < 1000; ++i) {
+        std::ostringstream oss;
+        oss << "PUT " << gen() % 10001 << " " << std::fixed << std::setprecision(7) << dist(gen);
+        puts.push_back(oss.str());
+    }
+
+    std::vector<std::string> states;
+    for (int i = 0; i < 20; ++i) {
+        std::ostringstream oss;
+        oss << "STATE";
+        for (int j = 0; j <= 100; ++j) {
+            oss << " " << std::fixed << std::setprecision(7) << dist(gen);
+        }
+        states.push_back(oss.str());
+    }
+
+    double regex_put = measure(puts, 20, [](std::string const& line) {
+        if (legacy::validate_put(line)) {
+            keep(legacy::parse_put(line));
+        }
+    });
+    double scan_put_ns = measure(puts, 20, [](std::string const& line) {
+        keep(scan_put(line));
+    });
+    report("PUT", regex_put, scan_put_ns);
+
+    double regex_state = measure(states, 20, [](std::string const& line) {
+        if (legacy::validate_state(line)) {
+            keep(legacy::parse_state(line));
+        }
+    });
+    double scan_state_ns = measure(states, 20, [](std::string const& line) {
+        keep(scan_state(line));
+    });
+    report("STATE (k = 100)", regex_state, scan_state_ns);
+}
+
+// Run a function repeatedly and return nanoseconds per call.
+template <typename F>
+static double measure_calls(std::size_t rounds, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < rounds; ++r) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(rounds);
+}
+
+// Compare point by point poly_val with the batched poly_vals paths
+// over 0..K for a degree 8 polynomial, and check the results are bit-identical.
+static void bench_poly() {
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<double> dist(-10.0, 10.0);
+
+    std::vector<double> coeffs(9);
+    for (auto& coeff : coeffs) {
+        coeff = dist(gen);
+    }
+
+    std::vector<std::pair<std::string, detail::PolyPath>> paths = {
+        {"scalar", detail::PolyPath::SCALAR},
+        {"avx2", detail::PolyPath::AVX2},
+        {"avx512", detail::PolyPath::AVX512},
+        {"auto", detail::PolyPath::AUTO},
+    };
+
+    for (std::size_t k : {10, 100, 1000, 10000}) {
+        std::vector<double> expected(k + 1);
+        for (std::size_t j = 0; j <= k; ++j) {
+            expected[j] = detail::poly_val(coeffs, j);
+        }
+
+        std::size_t rounds = 2000000 / (k + 1) + 10;
+        double single = measure_calls(rounds, [&] {
+            for (std::size_t j = 0; j <= k; ++j) {
+                expected[j] = detail::poly_val(coeffs, j);
+            }
+            keep(expected);
+        });
+
+        for (auto const& [name, path] : paths) {
+            auto values = detail::poly_vals(coeffs, 0, k + 1, path);
+            if (std::memcmp(values.data(), expected.data(), expected.size() * sizeof(double)) != 0) {
+                err("poly_vals ", name, " differs from poly_val at K = ", k);
+            }
+
+            double batched = measure_calls(rounds, [&] {
+                keep(detail::poly_vals(coeffs, 0, k + 1, path));
+            });
+            report("poly_vals " + name + " (K = " + std::to_string(k) + ")", single, batched);
+        }
+    }
+}
+
+// Check that binary frames decode to what was encoded: scores exactly at any
+// magnitude, values saturated at the fixed-point range instead of wrapping.
+static void check_framing() {
+    std::size_t mismatches = 0;
+
+    std::vector<std::pair<std::string, double>> scoring = {
+        {"a", 0.0}, {"b", -3.25}, {"c", 123456.7891234}, {"d", 9.3e11},
+        {"e", 1.5e16}, {"f", 1.8e20}, {"g", -2.5e150}, {"h", 1.7e308},
+    };
+    auto frame = encode_scoring(scoring);
+    auto decoded = decode_scoring(std::string_view(frame).substr(FRAME_HEADER_SIZE + 1));
+    if (decoded != scoring) {
+        ++mismatches;
+        err("SCORING round trip mismatch");
+    }
+
+    constexpr double LARGEST = static_cast<double>(INT64_MAX) / FIXED_SCALE;
+    std::vector<std::pair<double, double>> values = {
+        {-2.5, -2.5}, {1e12, LARGEST}, {-1e12, -LARGEST}, {1e300, LARGEST}, {-1e300, -LARGEST},
+    };
+    for (auto const& [value, expected] : values) {
+        auto put = encode_point_value(MessageType::PUT, 1, value);
+        auto parsed = decode_point_value(std::string_view(put).substr(FRAME_HEADER_SIZE + 1));
+        if (!parsed.has_value() || parsed->second != expected) {
+            ++mismatches;
+            err("PUT of ", value, " decoded as ", parsed.has_value() ? parsed->second : NAN);
+        }
+    }
+
+    std::cout << "framing check: " << scoring.size() << " scores, " << values.size()
+              << " values, " << mismatches << " mismatches\n";
+}
+
+// Cost of one accepted PUT in each framing: the client builds the PUT,
+// the server parses it and builds the STATE, the client parses the STATE.
+static void bench_framing() {
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<double> dist(-5.0, 5.0);
+
+    for (std::size_t k : {10, 100, 1000}) {
+        std::vector<double> state(k + 1);
+        for (auto& value : state) {
+            value = std::round(dist(gen) * 1e7) / 1e7;
+        }
+
+        int16_t point = static_cast<int16_t>(k / 2);
+        double value = 1.2345678;
+        std::size_t rounds = 2000000 / (k + 1) + 10;
+
+        std::size_t text_bytes = build_put(point, value).size() + build_state(state).size();
+        double text = measure_calls(rounds, [&] {
+            std::string put = build_put(point, value);
+            auto parsed = scan_put(std::string_view(put).substr(0, put.size() - 2));
+            std::string reply = build_state(state);
+            keep(parsed);
+            keep(scan_state(std::string_view(reply).substr(0, reply.size() - 2)));
+        });
+
+        std::size_t binary_bytes = encode_point_value(MessageType::PUT, point, value).size()
+                                 + encode_values(MessageType::STATE, state).size();
+        double binary = measure_calls(rounds, [&] {
+            std::string put = encode_point_value(MessageType::PUT, point, value);
+            auto parsed = decode_point_value(std::string_view(put).substr(FRAME_HEADER_SIZE + 1));
+            std::string reply = encode_values(MessageType::STATE, state);
+            keep(parsed);
+            keep(decode_values(std::string_view(reply).substr(FRAME_HEADER_SIZE + 1)));
+        });
+
+        // STATE_DELTA sessions: the client applies the new value to its mirror.
+        std::vector<double> mirror = state;
+        std::vector<std::pair<int16_t, double>> changes{{point, state[point]}};
+        std::size_t delta_bytes = build_put(point, value).size() + build_state_delta(changes).size();
+        double delta = measure_calls(rounds, [&] {
+            std::string put = build_put(point, value);
+            auto parsed = scan_put(std::string_view(put).substr(0, put.size() - 2));
+            std::string reply = build_state_delta(changes);
+            keep(parsed);
+            auto received = scan_state_delta(std::string_view(reply).substr(0, reply.size() - 2));
+            if (received.has_value()) {
+                for (auto const& [p, v] : received.value()) {
+                    mirror[p] = v;
+                }
+            }
+        });
+        keep(mirror);
+
+        report("PUT + STATE (K = " + std::to_string(k) + ")", text, binary);
+        report("PUT + STATE_DELTA (K = " + std::to_string(k) + ")", text, delta);
+        std::cout << "    bytes per PUT: text " << text_bytes << ", binary " << binary_bytes
+                  << ", text delta " << delta_bytes << "\n";
+    }
+}
+
+// Check that STATE messages match the stream based builder, values include
+// exact and near rounding halfway cases, signed zeros and magnitudes up to the largest double.
+static void check_format() {
+    std::mt19937_64 gen(3);
+    std::uniform_real_distribution<double> small(-5.0, 5.0);
+    std::uniform_int_distribution<int> exponent(-40, 308);
+    std::size_t messages = 20000, mismatches = 0;
+
+    for (std::size_t i = 0; i < messages; ++i) {
+        std::vector<double> values(16);
+        for (auto& value : values) {
+            switch (gen() % 5) {
+                case 0:
+                    value = small(gen);
+                    break;
+                case 1:
+                    value = std::round(small(gen) * 1e8) / 1e8 + 5e-8;
+                    break;
+                case 2:
+                    value = small(gen) * std::pow(10.0, exponent(gen));
+                    break;
+                case 3:
+                    // Multiples of 1/256 scaled by 1e7 are exact halfway cases.
+                    value = std::ldexp(static_cast<double>(gen() % 2561) - 1280.0, -(gen() % 12));
+                    break;
+                default:
+                    value = std::copysign(0.0, small(gen));
+            }
+        }
+
+        std::string expected = legacy::build_state(values);
+        if (build_state(values) != expected && ++mismatches <= 10) {
+            err("formatter mismatch, expected ", expected);
+        }
+    }
+
+    std::cout << "format check: " << messages << " STATE messages, " << mismatches << " mismatches\n";
+}
+
+// Compare the stream based STATE builder with the to_chars one.
+static void bench_format() {
+    std::mt19937 gen(13);
+    std::uniform_real_distribution<double> dist(-5.0, 5.0);
+
+    for (std::size_t k : {10, 100, 1000}) {
+        std::vector<double> state(k + 1);
+        for (auto& value : state) {
+            value = dist(gen);
+        }
+
+        std::size_t rounds = 2000000 / (k + 1) + 10;
+        double stream = measure_calls(rounds, [&] {
+            keep(legacy::build_state(state));
+        });
+        double to_chars = measure_calls(rounds, [&] {
+            keep(build_state(state));
+        });
+        report("STATE (K = " + std::to_string(k) + ")", stream, to_chars);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // Available benchmarks, all of them run if none is named.
+    std::vector<std::pair<std::string, std::function<void()>>> benches = {
+        {"scanner", [] { check_scanner(); bench_scanner(); }},
+        {"poly", [] { bench_poly(); }},
+        {"framing", [] { check_framing(); bench_framing(); }},
+        {"format", [] { check_format(); bench_format(); }},
+    };
+
+    for (auto const& [name, run] : benches) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            selected |= name == argv[i];
+        }
+
+        if (selected) {
+            std::cout << "== " << name << " ==\n";
+            run();
+        }
+    }
+}
\ No newline at end of file
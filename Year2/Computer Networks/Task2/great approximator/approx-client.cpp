@@ -3,18 +3,22 @@
 #include <sys/socket.h>
 #include <poll.h>
 #include <unistd.h>
-#include <regex>
-#include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <tuple>
+#include <deque>
+#include <algorithm>
 #include <signal.h>
 
 #include "protocol.h"
+#include "binary.h"
+#include "buffer.h"
 #include "detail.h"
 #include "err.h"
 
 // Useful constraints.
 static constexpr std::size_t BUFFER_SIZE = 1024;
+static constexpr std::size_t MAX_WINDOW = 10000;
 
 // Simple enum on operating modes.
 enum class Mode {
@@ -29,21 +33,32 @@ struct Config {
     Mode mode{Mode::MANUAL};        // Client mode. 
     std::string ip_str{};           // Server ip address.
     uint16_t port{};                // Server port.
+    std::size_t window{1};          // Maximum number of PUTs awaiting a response (for AUTOMATIC).
+    bool binary{false};             // Flag whether to request binary framing.
+    bool delta{false};              // Flag whether to request STATE_DELTA responses.
 };
 
 // Simple struct to hold current state of the program.
 struct ClientState {
-    std::string write_buffer;       // Write buffer.
-    std::string read_buffer;        // Read buffer.
+    OutputQueue write_buffer;       // Write buffer.
+    LineBuffer read_buffer;         // Read buffer.
     std::string coeff_buffer;       // Coeff buffer (for delaying MANUAL PUTs).
     std::string stdin_buffer;       // STDIN buffer (for MANUAL).
     std::vector<double> coeffs;     // Client polynomial coefficients.
-    std::vector<double> state;      // Current polynomial approximation state.
+    std::vector<double> state;      // Current polynomial approximation state, mirrored from STATE_DELTAs.
     bool received_coeff = false;    // Flag whether server sent COEFF message. (for MANUAL)
     bool received_message = false;  // Flage whether server sent any message.
-    bool put_eligible = false;      // Flag whether client is eligible to send a PUT (for AUTOMATIC).
+    bool binary = false;            // Flag whether the session uses binary framing.
+    bool delta = false;             // Flag whether the session uses STATE_DELTA.
+    bool resync_requested = false;  // Flag whether a full STATE was requested and not received yet.
+    std::deque<int16_t> in_flight;  // Points of PUTs awaiting a response, oldest first (for AUTOMATIC).
     int16_t sent = 0;               // Number of sent PUTs (for AUTOMATIC). 
     int16_t K = 1000;               // Available PUT points (initial value is arbitrary if its positive).
+    bool received_k = false;        // Flag whether a STATE reported the available points (for AUTOMATIC).
+    uint32_t accepted = 0;          // Number of PUTs answered with STATE (for AUTOMATIC).
+    int64_t first_put_time = -1;    // Time of the first PUT, -1 before it (for AUTOMATIC).
+    int64_t last_response_time = 0; // Time of the last response to a PUT (for AUTOMATIC).
+    detail::Clock clock;            // Time since the client started.
 };
 
 // Flag to determine whether the program should continue running.
@@ -57,7 +72,7 @@ static void catch_int([[maybe_unused]] int) {
 
 // Print the usage message and exit the program.
 [[noreturn]] static void print_usage(char* progname) {
-    fatal("Usage: ", progname, " -u <player_id> -s <server> -p <port> [-4] [-6] [-a]");
+    fatal("Usage: ", progname, " -u <player_id> -s <server> -p <port> [-4] [-6] [-a] [-w <window>] [-b] [-d]");
 }
 
 // Parse the program parameters.
@@ -67,11 +82,12 @@ static Config parse_args(int argc, char* argv[]) {
     std::string server = "";
     uint16_t port = 0;
 
-    bool given_u = false, given_s = false, given_p = false, given_4 = false, given_6 = false, given_a = false;
+    bool given_u = false, given_s = false, given_p = false, given_4 = false, given_6 = false, given_a = false,
+         given_w = false, given_b = false, given_d = false;
 
     opterr = 0;
     int opt;
-    while ((opt = getopt(argc, argv, "u:s:p:46a")) != -1) {
+    while ((opt = getopt(argc, argv, "u:s:p:46aw:bd")) != -1) {
         switch (opt) {
             case 'u':
                 if (given_u) {
@@ -125,6 +141,42 @@ static Config parse_args(int argc, char* argv[]) {
                 
                 given_a = true;
                 break;
+
+            case 'w':
+                if (given_w) {
+                    print_usage(argv[0]);
+                }
+
+                try {
+                    config.window = std::stoul(optarg);
+                } catch (std::exception const&) {
+                    config.window = 0;
+                }
+
+                if (config.window < 1 || config.window > MAX_WINDOW) {
+                    fatal("Window must be between 1 and ", MAX_WINDOW);
+                }
+
+                given_w = true;
+                break;
+
+            case 'b':
+                if (given_b) {
+                    print_usage(argv[0]);
+                }
+
+                config.binary = true;
+                given_b = true;
+                break;
+
+            case 'd':
+                if (given_d) {
+                    print_usage(argv[0]);
+                }
+
+                config.delta = true;
+                given_d = true;
+                break;
             default:
                 print_usage(argv[0]);
         }
@@ -139,6 +191,10 @@ static Config parse_args(int argc, char* argv[]) {
         fatal("Player ID, server address and port must be specified.");
     }
 
+    if (given_w && !given_a) {
+        fatal("Window can only be set in the automatic mode.");
+    }
+
     // Set the appropriate IP version.
     int ai_family = AF_UNSPEC;
     if (given_4 && given_6) {
@@ -157,17 +213,7 @@ static Config parse_args(int argc, char* argv[]) {
 
 // Parse stdin input.
 static std::optional<std::pair<int16_t, double>> parse_input(std::string const& input) {
-    static const std::regex pattern(R"(^\d+ -?\d+(\.\d{0,7})?$)");
-    std::istringstream iss(input);
-    int16_t point;
-    double value;
-
-    if (!std::regex_match(input, pattern)) {
-        return std::nullopt;
-    }
-
-    iss >> point >> value;
-    return std::make_pair(point, value);
+    return scan_point_value(input);
 }
 
 // Poll on sockets, return true if poll goes through.
@@ -197,19 +243,14 @@ static bool wait_on_poll(std::vector<pollfd>& fds) {
 // Write to socket.
 // Closes the socket if errors occur.
 // Returns false if the write results in a disconnect.
-static bool send_messages(std::vector<pollfd> const& fds, std::string& write_buffer) {
+static bool send_messages(std::vector<pollfd> const& fds, OutputQueue& write_buffer) {
     if (!write_buffer.empty() && (fds[0].revents & POLLOUT)) {
-        ssize_t sent = send(fds[0].fd, write_buffer.data(), write_buffer.size(), 0);
-        if (sent < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                sent = 0;
-            } else {
-                err("Server disconnected or failed to send data to server.");
-                running = false;
-                return false;
-            }
+        ssize_t sent = write_buffer.send(fds[0].fd, 0);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            err("Server disconnected or failed to send data to server.");
+            running = false;
+            return false;
         }
-        write_buffer.erase(0, sent);
     }
 
     return true;
@@ -218,8 +259,9 @@ static bool send_messages(std::vector<pollfd> const& fds, std::string& write_buf
 // Read from a socket.
 // Closes the socket if errors occur.
 // Returns false if the read results in a disconnect.
-static bool receive_messages(std::vector<pollfd> const& fds, char* buffer, std::string& read_buffer) {
-    ssize_t received = recv(fds[0].fd, buffer, sizeof(buffer), 0);
+static bool receive_messages(std::vector<pollfd> const& fds, LineBuffer& read_buffer) {
+    char* buffer = read_buffer.write_area(BUFFER_SIZE);
+    ssize_t received = recv(fds[0].fd, buffer, BUFFER_SIZE, 0);
     if (received < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             return true;
@@ -236,27 +278,28 @@ static bool receive_messages(std::vector<pollfd> const& fds, char* buffer, std::
 
         return false;
     } else {
-        read_buffer.append(buffer, received);
+        read_buffer.commit(received);
         return true;
     }
 }
 
 // Print error message and change a referenced flag.
 // Used basically as a C macro.
-static void invalidate_message(std::string const& message, Config const& config, bool& valid) {
+static void invalidate_message(std::string_view message, Config const& config, bool& valid) {
     msg_error(config.ip_str, config.port, message, config.player_id);
     valid = false;
 }
 
 // Handle a COEFF message, return false if message is invalid.
-static bool handle_coeff(std::string const& message, Config const& config,
+static bool handle_coeff(std::optional<std::vector<double>> parsed,
+                         std::string_view message, Config const& config,
                          bool& received_coeff, bool& valid,
                          std::vector<double>& coeffs) {
-    if (!validate_coeff(message) || received_coeff) {
+    if (!parsed.has_value() || received_coeff) {
         invalidate_message(message, config, valid);
         return false;
     } else {
-        coeffs = parse_coeff(message);
+        coeffs = std::move(parsed.value());
         std::cout << "Received coefficients:";
         for (auto const& coeff : coeffs) {
             std::cout << " " << std::fixed << std::setprecision(7) << coeff;
@@ -269,15 +312,15 @@ static bool handle_coeff(std::string const& message, Config const& config,
 }
 
 // Handle a SCORING message, return false if message is invalid.
-static bool handle_scoring(std::string const& message, Config const& config,
+static bool handle_scoring(std::optional<std::vector<std::pair<std::string, double>>> const& scoring,
+                           std::string_view message, Config const& config,
                            bool& received_coeff, bool& valid) {
-    if (!validate_scoring(message) || !received_coeff) {
+    if (!scoring.has_value() || !received_coeff) {
     invalidate_message(message, config, valid);
         return false;
     } else {
-        auto scoring = parse_scoring(message);
         std::cout << "Game end, scoring:";
-        for (const auto& [player_id, score] : scoring) {
+        for (const auto& [player_id, score] : scoring.value()) {
             std::cout << " " << player_id << " " << std::fixed << std::setprecision(7) << score;
         }
         std::cout << "\n";
@@ -288,13 +331,15 @@ static bool handle_scoring(std::string const& message, Config const& config,
 }
 
 // Handle a BAD_PUT message, return false if message is invalid.
-static bool handle_bad_put(std::string const& message, Config const& config,
-                           bool& received_coeff, bool& valid) {
-    if (!validate_bad_put(message) || !received_coeff) {
+static bool handle_bad_put(std::optional<std::pair<int16_t, double>> const& bad_put,
+                           std::string_view message, Config const& config,
+                           bool& received_coeff, bool& valid, int16_t& put_point) {
+    if (!bad_put.has_value() || !received_coeff) {
         invalidate_message(message, config, valid);
         return false;
     } else {
-        auto [point, value] = parse_bad_put(message);
+        auto [point, value] = bad_put.value();
+        put_point = point;
         std::cout << "Received bad put at point " << static_cast<int>(point) << " with value " 
                     << std::fixed << std::setprecision(7) << value << "\n";
 
@@ -303,13 +348,15 @@ static bool handle_bad_put(std::string const& message, Config const& config,
 }
 
 // Handle a PENALTY message, return false if message is invalid.
-static bool handle_penalty(std::string const& message, Config const& config,
-                           bool& received_coeff, bool& valid) {
-    if (!validate_penalty(message) || !received_coeff) {
+static bool handle_penalty(std::optional<std::pair<int16_t, double>> const& penalty,
+                           std::string_view message, Config const& config,
+                           bool& received_coeff, bool& valid, int16_t& put_point) {
+    if (!penalty.has_value() || !received_coeff) {
         invalidate_message(message, config, valid);
         return false;
     } else {
-        auto [point, value] = parse_penalty(message);
+        auto [point, value] = penalty.value();
+        put_point = point;
         std::cout << "Received penalty at point " << static_cast<int>(point) << " with value " 
                     << std::fixed << std::setprecision(7) << value << "\n";
         return true;
@@ -317,14 +364,15 @@ static bool handle_penalty(std::string const& message, Config const& config,
 }
 
 // Handle a STATE message, return false if message is invalid.
-static bool handle_state(std::string const& message, Config const& config,
+static bool handle_state(std::optional<std::vector<double>> parsed,
+                         std::string_view message, Config const& config,
                          bool& received_coeff, bool& valid,
                          std::vector<double>& state) {
-    if (!validate_state(message) || !received_coeff) {
+    if (!parsed.has_value() || !received_coeff) {
         invalidate_message(message, config, valid);
         return false;
     } else {
-        state = parse_state(message);
+        state = std::move(parsed.value());
         std::cout << "Received state:";
         for (const auto& val : state) {
             std::cout << " " << std::fixed << std::setprecision(7) << val;
@@ -334,59 +382,161 @@ static bool handle_state(std::string const& message, Config const& config,
     }
 }
 
+// Handle a STATE_DELTA message, return false if message is invalid.
+// Applies the new values to the state mirror, resync is set if some point
+// is not mirrored, which happens only if no full STATE was received yet.
+static bool handle_state_delta(std::optional<std::vector<std::pair<int16_t, double>>> const& parsed,
+                               std::string_view message, Config const& config,
+                               bool& received_coeff, bool& valid,
+                               std::vector<double>& state, bool& resync) {
+    if (!parsed.has_value() || !received_coeff) {
+        invalidate_message(message, config, valid);
+        return false;
+    } else {
+        std::cout << "Received state update:";
+        for (const auto& [point, value] : parsed.value()) {
+            std::cout << " " << static_cast<int>(point) << " " << std::fixed << std::setprecision(7) << value;
+            if (point < 0 || static_cast<std::size_t>(point) >= state.size()) {
+                resync = true;
+            } else {
+                state[point] = value;
+            }
+        }
+        std::cout << "\n";
+        return true;
+    }
+}
+
+// Build a PUT in the framing of the session.
+static std::string make_put(ClientState const& cs, int16_t point, double value) {
+    return cs.binary ? encode_point_value(MessageType::PUT, point, value) : build_put(point, value);
+}
+
+// Ask the server for a full STATE, unless already waiting for one.
+static void request_state(ClientState& cs) {
+    if (!cs.resync_requested) {
+        cs.write_buffer.push(cs.binary ? encode_state_request() : build_state_request());
+        cs.resync_requested = true;
+    }
+}
+
 // Deduce the next PUT to be sent and add it to buffer.
 // Used in the AUTOMATIC mode.
 static void automatic_put(ClientState& cs) {
     std::cout << "Putting " << detail::poly_val(cs.coeffs, cs.sent)
               << " in " << cs.sent << ".\n";
-    cs.write_buffer += build_put(cs.sent, detail::poly_val(cs.coeffs, cs.sent));
+    cs.write_buffer.push(make_put(cs, cs.sent, detail::poly_val(cs.coeffs, cs.sent)));
+    cs.in_flight.push_back(cs.sent);
     ++cs.sent;
-    cs.put_eligible = false;
+
+    if (cs.first_put_time < 0) {
+        cs.first_put_time = cs.clock.get_time();
+    }
+}
+
+// Match a response with an awaiting PUT, opening a slot in the window.
+// BAD_PUT and PENALTY name their point, STATE answers the oldest PUT left,
+// as it comes after the server's delay and later than immediate PENALTYs.
+// Used in the AUTOMATIC mode.
+static void complete_put(ClientState& cs, std::optional<int16_t> point) {
+    auto it = cs.in_flight.begin();
+    if (point.has_value()) {
+        it = std::find(cs.in_flight.begin(), cs.in_flight.end(), point.value());
+    }
+
+    if (it != cs.in_flight.end()) {
+        cs.in_flight.erase(it);
+    }
+
+    cs.last_response_time = cs.clock.get_time();
+}
+
+// Print the PUT throughput achieved in the AUTOMATIC mode.
+static void report_throughput(ClientState const& cs) {
+    if (cs.first_put_time < 0) {
+        return;
+    }
+
+    double seconds = static_cast<double>(cs.last_response_time - cs.first_put_time) / 1000.0;
+    std::cout << "Sent " << cs.sent << " PUTs, " << cs.accepted << " accepted in "
+              << std::fixed << std::setprecision(3) << seconds << " s";
+    if (seconds > 0) {
+        std::cout << " (" << static_cast<double>(cs.accepted) / seconds << " points/s)";
+    }
+    std::cout << ".\n";
 }
 
 // Handle a message depending on its type and operating mode.
+// In a binary session payload is the frame payload and message only describes it,
+// otherwise both are the received line.
 // Return false if message was invalid.
 static bool handle_message(Mode mode, MessageType type, Config const& config,
-                           ClientState& cs, std::string const& message) {
+                           ClientState& cs, std::string_view message, std::string_view payload) {
     bool valid = true;
+    bool resync = false;
+    int16_t point = 0;
     switch (type) {
         case MessageType::COEFF:
-            if (handle_coeff(message, config, cs.received_coeff, valid, cs.coeffs)) {
+            if (handle_coeff(cs.binary ? decode_values(payload) : scan_coeff(message),
+                             message, config, cs.received_coeff, valid, cs.coeffs)) {
                 // Allow PUT sending, implementation depends on mode.
-                if (mode == Mode::AUTOMATIC) {         
-                    cs.put_eligible = true;
-                } else if (mode == Mode::MANUAL) {
-                    cs.write_buffer += cs.coeff_buffer;
+                if (mode == Mode::MANUAL) {
+                    cs.write_buffer.push(std::move(cs.coeff_buffer));
                     cs.coeff_buffer.clear();
                 }
             }
 
             break;
         case MessageType::SCORING:
-            handle_scoring(message, config, cs.received_coeff, valid);
+            handle_scoring(cs.binary ? decode_scoring(payload) : scan_scoring(message),
+                           message, config, cs.received_coeff, valid);
 
             break;
         case MessageType::BAD_PUT:
-            if (handle_bad_put(message, config, cs.received_coeff, valid)) {
+            if (handle_bad_put(cs.binary ? decode_point_value(payload) : scan_bad_put(message),
+                               message, config, cs.received_coeff, valid, point)) {
                 if (mode == Mode::AUTOMATIC) {
-                    cs.put_eligible = true;      // Automatic mode waits for response before PUTs.
+                    complete_put(cs, point);    // Automatic mode waits for responses before PUTs.
                 }
             }
 
             break;
         case MessageType::PENALTY:
-            if (handle_penalty(message, config, cs.received_coeff, valid)) {
+            if (handle_penalty(cs.binary ? decode_point_value(payload) : scan_penalty(message),
+                               message, config, cs.received_coeff, valid, point)) {
                 if (mode == Mode::AUTOMATIC) {
-                    cs.put_eligible = true;     // Automatic mode waits for response before PUTs.
+                    complete_put(cs, point);    // Automatic mode waits for responses before PUTs.
                 }
             }
 
             break;
         case MessageType::STATE:
-            if (handle_state(message, config, cs.received_coeff, valid, cs.state)) {
+            if (handle_state(cs.binary ? decode_values(payload) : scan_state(message),
+                             message, config, cs.received_coeff, valid, cs.state)) {
+                if (cs.resync_requested) {
+                    cs.resync_requested = false;    // Answers the request, not a PUT.
+                } else if (mode == Mode::AUTOMATIC) {
+                    complete_put(cs, std::nullopt);
+                    ++cs.accepted;
+                }
+
                 if (mode == Mode::AUTOMATIC) {
-                    cs.put_eligible = true;     // Automatic mode waits for response before PUTs.
                     cs.K = cs.state.size();     // Read the STATE size to send appropriate PUTs.
+                    cs.received_k = true;
+                }
+            }
+
+            break;
+        case MessageType::STATE_DELTA:
+            if (handle_state_delta(cs.binary ? decode_point_values(payload) : scan_state_delta(message),
+                                   message, config, cs.received_coeff, valid, cs.state, resync)) {
+                if (mode == Mode::AUTOMATIC) {
+                    complete_put(cs, std::nullopt);
+                    ++cs.accepted;
+                }
+
+                if (resync) {
+                    request_state(cs);
                 }
             }
 
@@ -400,18 +550,24 @@ static bool handle_message(Mode mode, MessageType type, Config const& config,
 
 // Read from stdin and send an appropriate PUT message.
 // Used in the MANUAL mode.
+// A "STATE" line requests a full STATE in sessions using STATE_DELTA.
 static void read_stdin(ClientState& cs) {
     std::getline(std::cin, cs.stdin_buffer);
+    if (cs.delta && cs.received_coeff && scan_state_request(cs.stdin_buffer)) {
+        request_state(cs);
+        return;
+    }
+
     auto input = parse_input(cs.stdin_buffer);
     
     // Stdin input must be correct.
     if (input.has_value()) {
         std::cout << "Putting " << input->second << " in " << input->first << ".\n";
         if (!cs.received_coeff) {
-            cs.coeff_buffer += build_put(input->first, input->second);  // Wait for COEFF before adding to write buffer.
+            cs.coeff_buffer += make_put(cs, input->first, input->second);  // Wait for COEFF before adding to write buffer.
         }
         else {
-            cs.write_buffer += build_put(input->first, input->second);
+            cs.write_buffer.push(make_put(cs, input->first, input->second));
         }
     } else {
         err("invalid input line ", cs.stdin_buffer);
@@ -421,15 +577,27 @@ static void read_stdin(ClientState& cs) {
 // Loop over received messages and handle them.
 static void parse_loop(Mode mode, Config const& config, ClientState& cs) {
     while (true) {
-        auto line = extract_line(cs.read_buffer);
-        if (!line.has_value()) {
-            break;
-        }
+        bool valid;
+
+        if (cs.binary) {
+            bool malformed = false;
+            auto frame = next_frame(cs.read_buffer, malformed);
+            if (malformed) {
+                fatal("Malformed frame from server.");
+            } else if (!frame.has_value()) {
+                break;
+            }
 
-        std::string message = line.value();
-        MessageType type = get_message_type(message);
+            valid = handle_message(mode, frame->type, config, cs, describe_frame(frame.value()), frame->payload);
+        } else {
+            auto line = cs.read_buffer.next_line();
+            if (!line.has_value()) {
+                break;
+            }
 
-        bool valid = handle_message(mode, type, config, cs, message);
+            std::string_view message = line.value();
+            valid = handle_message(mode, get_message_type(message), config, cs, message, message);
+        }
 
         // If the first message is invalid, disconnect fatally.
         if (!valid && !cs.received_message) {
@@ -445,9 +613,10 @@ static void parse_loop(Mode mode, Config const& config, ClientState& cs) {
 static void run_client(Mode mode, Config const& config, int sock) {
     ClientState cs{};
     std::vector<pollfd> fds{};
-    char buffer[BUFFER_SIZE];
 
-    cs.write_buffer += build_hello(config.player_id);
+    cs.binary = config.binary;
+    cs.delta = config.delta;
+    cs.write_buffer.push(build_hello(config.player_id, {config.binary, config.delta}));
 
     // Prepare pollfd structures according to mode.
     if (mode == Mode::AUTOMATIC) {
@@ -482,7 +651,10 @@ static void run_client(Mode mode, Config const& config, int sock) {
 
         // Disjoint mode logic.
         if (mode == Mode::AUTOMATIC) {
-            if (cs.put_eligible && cs.sent <= cs.K) {
+            // Keep up to window PUTs awaiting a response, only one until a STATE reports
+            // the available points, so that the window can't overshoot them.
+            std::size_t window = cs.received_k ? config.window : 1;
+            while (cs.received_coeff && cs.in_flight.size() < window && cs.sent < cs.K) {
                 automatic_put(cs);
             }
         } else if (mode == Mode::MANUAL) {
@@ -495,9 +667,13 @@ static void run_client(Mode mode, Config const& config, int sock) {
         // result in a graceful disconnect, but no need to skip the iteration 
         // as we're already at the end.
         if (fds[0].revents & POLLIN) {
-            receive_messages(fds, buffer, cs.read_buffer);
+            receive_messages(fds, cs.read_buffer);
         }
     }
+
+    if (mode == Mode::AUTOMATIC) {
+        report_throughput(cs);
+    }
 }
 
 int main(int argc, char *argv[]) {
@@ -0,0 +1,540 @@
+#include <string>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <signal.h>
+
+#include "protocol.h"
+#include "buffer.h"
+#include "detail.h"
+#include "event_loop.h"
+#include "err.h"
+
+// Useful constants.
+constexpr std::size_t BUFFER_SIZE = 4096;
+constexpr std::size_t MAX_BOTS = 100000;
+
+// Simple struct to hold console parameters.
+struct Config {
+    sockaddr_storage server{};          // Server address.
+    std::size_t bots = 1000;            // Number of concurrent sessions.
+    double rate = 0.0;                  // Target PUTs per second for all bots, 0 for unlimited.
+    int64_t duration = 10;              // Length of the run in seconds.
+    Backend backend = Backend::EPOLL;   // Event loop backend.
+};
+
+// Single AUTOMATIC mode session.
+struct Bot {
+    int fd{-1};                         // Socket, -1 if not connected.
+    std::string player_id{};            // Player id sent in HELLO.
+    OutputQueue write_buffer{};         // Write buffer.
+    LineBuffer read_buffer{};           // Read buffer.
+    std::vector<double> coeffs{};       // Polynomial coefficients.
+    bool received_coeff{};              // Flag whether server sent COEFF message.
+    bool awaiting{};                    // Flag whether a PUT awaits a response.
+    int16_t point{};                    // Next point to PUT in.
+    int16_t k{};                        // Highest point, known from the first STATE.
+    int64_t put_time{};                 // Time the awaited PUT was sent, in microseconds.
+};
+
+// Counters collected during the run.
+struct Stats {
+    std::vector<int64_t> latencies{};   // PUT to STATE round trips in microseconds.
+    uint64_t puts{};                    // Sent PUTs.
+    uint64_t states{};                  // Received STATEs.
+    uint64_t bad_puts{};                // Received BAD_PUTs.
+    uint64_t penalties{};               // Received PENALTYs.
+    uint64_t scorings{};                // Received SCORINGs, one per bot per game.
+    uint64_t connects{};                // Opened connections, including reconnects.
+    uint64_t errors{};                  // Connections closed by errors.
+};
+
+// Current state of the load generator.
+struct LoadContext {
+    Config const& config;               // Console parameters.
+    EventLoop& loop;                    // Readiness notifications for all bots.
+    std::vector<Bot> bots{};            // All sessions.
+    std::vector<int> bot_of_fd{};       // Bot index for each socket, -1 if none.
+    std::deque<std::size_t> ready{};    // Bots allowed to send the next PUT.
+    Stats stats{};                      // Collected counters.
+    int64_t start{};                    // Start of the run in microseconds.
+};
+
+// Flag to determine whether the program should continue running.
+// Changed by catching SIGINT or when the duration passes.
+static bool running = true;
+
+// Cancel the while loop after receiving a signal.
+static void catch_int([[maybe_unused]] int) {
+    running = false;
+}
+
+// Print the usage message and exit the program.
+[[noreturn]] static void print_usage(char* progname) {
+    fatal("Usage: ", progname, " -s <server> -p <port> [-c <bots>] [-r <puts/s>] [-d <seconds>]",
+          " [-e <poll|epoll|uring>] [-4] [-6]");
+}
+
+// Current time in microseconds, finer than detail::Clock for latency measurements.
+static int64_t now_us() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Parse the program parameters.
+static Config parse_args(int argc, char* argv[]) {
+    Config config{};
+
+    std::string server = "";
+    uint16_t port = 0;
+
+    bool given_s = false, given_p = false, given_c = false, given_r = false, given_d = false,
+         given_e = false, given_4 = false, given_6 = false;
+
+    opterr = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:c:r:d:e:46")) != -1) {
+        try {
+            switch (opt) {
+                case 's':
+                    if (given_s) {
+                        print_usage(argv[0]);
+                    }
+
+                    server = std::string(optarg);
+                    given_s = true;
+                    break;
+
+                case 'p':
+                    if (given_p) {
+                        print_usage(argv[0]);
+                    }
+
+                    port = detail::read_port(optarg);
+                    given_p = true;
+                    break;
+
+                case 'c':
+                    if (given_c) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.bots = std::stoul(optarg);
+                    if (config.bots < 1 || config.bots > MAX_BOTS) {
+                        fatal("Number of bots must be between 1 and ", MAX_BOTS);
+                    }
+
+                    given_c = true;
+                    break;
+
+                case 'r':
+                    if (given_r) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.rate = std::stod(optarg);
+                    if (config.rate < 0) {
+                        fatal("Rate must not be negative");
+                    }
+
+                    given_r = true;
+                    break;
+
+                case 'd':
+                    if (given_d) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.duration = std::stol(optarg);
+                    if (config.duration < 1) {
+                        fatal("Duration must be positive");
+                    }
+
+                    given_d = true;
+                    break;
+
+                case 'e':
+                    if (given_e) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.backend = parse_backend(optarg);
+                    given_e = true;
+                    break;
+
+                case '4':
+                    if (given_4) {
+                        print_usage(argv[0]);
+                    }
+
+                    given_4 = true;
+                    break;
+
+                case '6':
+                    if (given_6) {
+                        print_usage(argv[0]);
+                    }
+
+                    given_6 = true;
+                    break;
+
+                default:
+                    print_usage(argv[0]);
+            }
+        } catch (std::exception const&) {
+            fatal("Invalid argument for option:", std::string(1, static_cast<char>(opt)));
+        }
+    }
+
+    if (optind < argc) {
+        fatal("Unexpected positional argument: ", argv[optind]);
+    }
+
+    if (!(given_s && given_p)) {
+        fatal("Server address and port must be specified.");
+    }
+
+    // Set the appropriate IP version.
+    int ai_family = AF_UNSPEC;
+    if (given_4 && !given_6) {
+        ai_family = AF_INET;
+    } else if (given_6 && !given_4) {
+        ai_family = AF_INET6;
+    }
+
+    config.server = detail::get_server_address(server, port, ai_family);
+    return config;
+}
+
+// Raise the descriptor limit, so thousands of bots fit in one process.
+static void raise_fd_limit(std::size_t needed) {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur >= needed) {
+        return;
+    }
+
+    limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, needed);
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur < needed) {
+        err("descriptor limit too low for ", needed, " bots, raise it with ulimit -n");
+    }
+}
+
+// Open a new session for a bot and queue its HELLO.
+// The connection completes in the background, HELLO is sent once it's writable.
+static void connect_bot(LoadContext& ctx, std::size_t index) {
+    Bot& bot = ctx.bots[index];
+
+    int fd = socket(ctx.config.server.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        fatal("Failed to create socket.");
+    }
+
+    if (connect(fd, reinterpret_cast<sockaddr const*>(&ctx.config.server), sizeof(ctx.config.server)) < 0
+        && errno != EINPROGRESS) {
+        fatal("Failed to connect to server.");
+    }
+
+    std::string player_id = bot.player_id;
+    bot = Bot{};
+    bot.fd = fd;
+    bot.player_id = std::move(player_id);
+    bot.write_buffer.push(build_hello(bot.player_id));
+
+    if (static_cast<std::size_t>(fd) >= ctx.bot_of_fd.size()) {
+        ctx.bot_of_fd.resize(fd + 1, -1);
+    }
+    ctx.bot_of_fd[fd] = index;
+    ctx.loop.add(fd, EVENT_READ | EVENT_WRITE);
+    ++ctx.stats.connects;
+}
+
+// Close the session of a bot and start a new one if the run still lasts.
+// The server disconnects all players after a game, so bots rejoin the next one.
+static void reconnect_bot(LoadContext& ctx, std::size_t index) {
+    Bot& bot = ctx.bots[index];
+    ctx.loop.remove(bot.fd);
+    ctx.bot_of_fd[bot.fd] = -1;
+    close(bot.fd);
+    bot.fd = -1;
+
+    if (running) {
+        connect_bot(ctx, index);
+    }
+}
+
+// Write as much of the write buffer as the socket accepts without blocking.
+// Returns false if the write results in a reconnect.
+static bool send_messages(LoadContext& ctx, std::size_t index) {
+    Bot& bot = ctx.bots[index];
+    while (!bot.write_buffer.empty()) {
+        ssize_t sent = bot.write_buffer.send(bot.fd, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            ++ctx.stats.errors;
+            reconnect_bot(ctx, index);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Update the event loop interest of a bot, writing is needed only with pending data.
+static void update_interest(LoadContext& ctx, std::size_t index) {
+    Bot const& bot = ctx.bots[index];
+    ctx.loop.modify(bot.fd, bot.write_buffer.empty() ? EVENT_READ : EVENT_READ | EVENT_WRITE);
+}
+
+// Finish the awaited PUT and let the bot send the next one.
+static void put_answered(LoadContext& ctx, std::size_t index) {
+    Bot& bot = ctx.bots[index];
+    if (bot.awaiting) {
+        bot.awaiting = false;
+        ctx.ready.push_back(index);
+    }
+}
+
+// Handle a single message from the server.
+// Returns false if the message ends the session.
+static bool handle_message(LoadContext& ctx, std::size_t index, std::string_view message) {
+    Bot& bot = ctx.bots[index];
+
+    switch (get_message_type(message)) {
+        case MessageType::COEFF:
+            if (auto coeffs = scan_coeff(message); coeffs.has_value() && !bot.received_coeff) {
+                bot.coeffs = std::move(coeffs.value());
+                bot.received_coeff = true;
+                ctx.ready.push_back(index);
+            }
+
+            break;
+        case MessageType::STATE:
+            if (auto state = scan_state(message); state.has_value() && bot.awaiting) {
+                ctx.stats.latencies.push_back(now_us() - bot.put_time);
+                ++ctx.stats.states;
+                bot.k = static_cast<int16_t>(state->size() - 1);
+                put_answered(ctx, index);
+            }
+
+            break;
+        case MessageType::BAD_PUT:
+            ++ctx.stats.bad_puts;
+            put_answered(ctx, index);
+
+            break;
+        case MessageType::PENALTY:
+            ++ctx.stats.penalties;
+            put_answered(ctx, index);
+
+            break;
+        case MessageType::SCORING:
+            ++ctx.stats.scorings;
+            return false;
+        default:
+            err("bad message for ", bot.player_id, ": ", message);
+    }
+
+    return true;
+}
+
+// Read from a socket until it would block and handle received messages.
+// Returns false if the read results in a reconnect.
+static bool receive_messages(LoadContext& ctx, std::size_t index) {
+    Bot& bot = ctx.bots[index];
+    while (true) {
+        char* buffer = bot.read_buffer.write_area(BUFFER_SIZE);
+        ssize_t received = recv(bot.fd, buffer, BUFFER_SIZE, MSG_DONTWAIT);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+
+            ++ctx.stats.errors;
+            reconnect_bot(ctx, index);
+            return false;
+        } else if (received == 0) {
+            reconnect_bot(ctx, index);
+            return false;
+        }
+
+        bot.read_buffer.commit(received);
+        while (auto line = bot.read_buffer.next_line()) {
+            if (!handle_message(ctx, index, line.value())) {
+                reconnect_bot(ctx, index);
+                return false;
+            }
+        }
+    }
+}
+
+// Send the next PUT of a bot, following the polynomial like the AUTOMATIC client.
+// Values are clamped to the allowed range, so the server never answers with BAD_PUT.
+static void send_put(LoadContext& ctx, std::size_t index) {
+    Bot& bot = ctx.bots[index];
+    double value = std::clamp(detail::poly_val(bot.coeffs, bot.point), -5.0, 5.0);
+
+    bot.write_buffer.push(build_put(bot.point, value));
+    bot.point = bot.point < bot.k ? bot.point + 1 : 0;
+    bot.awaiting = true;
+    bot.put_time = now_us();
+    ++ctx.stats.puts;
+
+    if (send_messages(ctx, index)) {
+        update_interest(ctx, index);
+    }
+}
+
+// Send PUTs of ready bots allowed by the target rate.
+// Returns the time in milliseconds until the next PUT is allowed, -1 if none waits.
+static int64_t pace_puts(LoadContext& ctx) {
+    while (!ctx.ready.empty()) {
+        if (ctx.config.rate > 0) {
+            double elapsed = static_cast<double>(now_us() - ctx.start) / 1e6;
+            double allowed = elapsed * ctx.config.rate;
+            if (static_cast<double>(ctx.stats.puts) >= allowed) {
+                double wait = (static_cast<double>(ctx.stats.puts) + 1 - allowed) / ctx.config.rate;
+                return static_cast<int64_t>(wait * 1000) + 1;
+            }
+        }
+
+        std::size_t index = ctx.ready.front();
+        ctx.ready.pop_front();
+
+        // Bot reconnected since it became ready.
+        Bot const& bot = ctx.bots[index];
+        if (bot.fd < 0 || !bot.received_coeff || bot.awaiting) {
+            continue;
+        }
+
+        send_put(ctx, index);
+    }
+
+    return -1;
+}
+
+// Handle a readiness event on a bot socket.
+static void handle_event(LoadContext& ctx, Event const& event) {
+    if (static_cast<std::size_t>(event.fd) >= ctx.bot_of_fd.size() || ctx.bot_of_fd[event.fd] < 0) {
+        return;     // Bot reconnected earlier in this batch.
+    }
+    std::size_t index = ctx.bot_of_fd[event.fd];
+
+    if (event.flags & EVENT_ERROR) {
+        ++ctx.stats.errors;
+        reconnect_bot(ctx, index);
+        return;
+    }
+
+    if ((event.flags & EVENT_READ) && !receive_messages(ctx, index)) {
+        return;
+    }
+
+    if (send_messages(ctx, index)) {
+        update_interest(ctx, index);
+    }
+}
+
+// Percentile of sorted latencies in milliseconds.
+static double percentile(std::vector<int64_t> const& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+
+    std::size_t index = std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()));
+    return static_cast<double>(sorted[index]) / 1000.0;
+}
+
+// Print the summary of the run.
+static void report(LoadContext& ctx, int64_t elapsed_us) {
+    Stats& stats = ctx.stats;
+    std::sort(stats.latencies.begin(), stats.latencies.end());
+    double seconds = static_cast<double>(elapsed_us) / 1e6;
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "duration:     " << seconds << " s\n"
+              << "bots:         " << ctx.config.bots << " (" << stats.connects << " connections, "
+                                  << stats.errors << " errors)\n"
+              << "PUTs:         " << stats.puts << " (" << stats.puts / seconds << " /s)\n"
+              << "STATEs:       " << stats.states << " (" << stats.states / seconds << " /s)\n"
+              << "BAD_PUTs:     " << stats.bad_puts << "\n"
+              << "PENALTYs:     " << stats.penalties << "\n"
+              << "SCORINGs:     " << stats.scorings << "\n"
+              << "STATE latency p50 " << percentile(stats.latencies, 0.5)
+              << " ms, p99 " << percentile(stats.latencies, 0.99)
+              << " ms, p999 " << percentile(stats.latencies, 0.999) << " ms\n";
+}
+
+// Main load generator loop.
+static void run_load(LoadContext& ctx) {
+    std::vector<Event> events;
+    int64_t end = ctx.start + ctx.config.duration * 1000000;
+
+    while (running) {
+        int64_t now = now_us();
+        if (now >= end) {
+            break;
+        }
+
+        // Wake up for the next allowed PUT or at the end of the run.
+        int64_t timeout = (end - now) / 1000 + 1;
+        int64_t pace = pace_puts(ctx);
+        if (pace >= 0) {
+            timeout = std::min(timeout, pace);
+        }
+
+        if (!ctx.loop.wait(timeout, events)) {
+            continue;
+        }
+
+        for (auto const& event : events) {
+            handle_event(ctx, event);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Config config = parse_args(argc, argv);
+
+    detail::install_signal_handler(SIGINT, catch_int, SA_RESTART);
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit(config.bots + 16);
+
+    std::unique_ptr<EventLoop> loop = make_event_loop(config.backend);
+    LoadContext ctx{config, *loop};
+    ctx.bots.resize(config.bots);
+
+    auto [ip_str, port] = detail::get_representation(config.server);
+    std::cout << "Starting " << config.bots << " bots against [" << ip_str << "]:" << port
+              << " using " << loop->name() << "\n";
+
+    ctx.start = now_us();
+    // Uppercase ids only, lowercase letters would make the server retard responses.
+    for (std::size_t i = 0; i < config.bots; ++i) {
+        ctx.bots[i].player_id = "BOT" + std::to_string(i);
+        connect_bot(ctx, i);
+    }
+
+    run_load(ctx);
+    report(ctx, now_us() - ctx.start);
+
+    running = false;
+    for (auto& bot : ctx.bots) {
+        if (bot.fd >= 0) {
+            close(bot.fd);
+        }
+    }
+}
@@ -1,24 +1,42 @@
 #include <string>
 #include <getopt.h>
 #include <sys/socket.h>
-#include <poll.h>
 #include <unistd.h>
-#include <map>
+#include <fcntl.h>
 #include <iostream>
 #include <iomanip>
-#include <fstream>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <signal.h>
+#include <pthread.h>
+#include <chrono>
 
 #include "protocol.h"
+#include "async_log.h"
+#include "binary.h"
+#include "buffer.h"
+#include "coeff_file.h"
 #include "detail.h"
+#include "event_loop.h"
+#include "handoff.h"
+#include "fd_table.h"
+#include "metrics.h"
+#include "recording.h"
+#include "timer_queue.h"
+#include "uring_loop.h"
 #include "err.h"
 
 // Useful constants.
 constexpr std::size_t BUFFER_SIZE = 1024;
 constexpr int64_t DISCONNECT_TIMEOUT = 3000;
+constexpr int64_t BAD_PUT_DELAY = 1000;
+constexpr int64_t OUTPUT_TIMEOUT = 5000;
 constexpr std::size_t CONNECT_QUEUE_SIZE = 32;
+constexpr unsigned MAX_SHARDS = 256;
+constexpr uint32_t STATE_SYNC_INTERVAL = 32;
 
 // Simple struct to hold console parameters.
 struct Config {
@@ -27,6 +45,13 @@ struct Config {
     uint16_t k = 100;                           // Available PUT points.
     uint8_t n = 4;                              // Polynomial degree.
     uint16_t port = 0;                          // Server port.
+    Backend backend = Backend::EPOLL;           // Event loop backend.
+    unsigned shards = 1;                        // Number of concurrent games, one thread each.
+    uint16_t metrics_port = 0;                  // Local port serving metrics, 0 if disabled.
+    std::size_t client_output_cap = 1 << 20;    // Queued bytes per client that pause reading from it.
+    std::size_t output_cap = 256 << 20;         // Queued bytes of all games that pause reading.
+    std::string record_file{};                  // File to record the session to, empty if disabled.
+    std::string replay_file{};                  // Recording to replay instead of serving, empty if disabled.
 };
 
 // Simple struct to hold client info.
@@ -34,26 +59,85 @@ struct Client {
     sockaddr_storage addr{};                                    // Client addres;
     std::vector<double> coeffs{};                               // Client polynomial coeffs.
     std::vector<double> state{};                                // Client approximation state.
-    std::multimap<int64_t, std::string> retarded_responses{};   // Awaiting client responses.
-    std::string write_buffer{};                                 // Client write buffer.
-    std::string read_buffer{};                                  // Client read buffer.
+    std::vector<double> values{};                               // Polynomial values at points 0..K, cached at HELLO.
+    std::vector<double> errors{};                               // Squared deviations of state from values at points 0..K.
+    uint64_t id{};                                              // Unique client id, never reused.
+    uint32_t pending_responses{};                               // Count of awaiting client responses.
+    OutputQueue write_buffer{};                                 // Client write buffer.
+    LineBuffer read_buffer{};                                   // Client read buffer.
     std::string player_id{};                                    // Client player id.
+    int fd{-1};                                                 // Client socket.
     std::string ip_str{};                                       // Client ip address, for printing.
     uint16_t port;                                              // Client port, for printing.
     int64_t connect_time{};                                     // Client connection time.
     bool received_hello{};                                      // Flag whether client sent HELLO message.
+    bool binary{};                                              // Flag whether client requested binary framing.
+    bool delta{};                                               // Flag whether client requested STATE_DELTA.
+    bool sending{};                                             // Flag whether an io_uring send is in flight.
+    std::size_t output{};                                       // Bytes queued for client, including retarded responses.
+    bool throttled{};                                           // Flag whether output is over the cap, reading is paused.
+    int64_t throttle_time{};                                    // Time the output went over the cap.
+    bool receiving{};                                           // Flag whether io_uring receives from client.
+    bool finished{};                                            // Flag whether the game ended, only SCORING remains to send.
+    uint32_t deltas{};                                          // STATE_DELTAs sent since the last full STATE.
     uint32_t sent_puts{};                                       // Count of correct PUTs sent by client.
     int64_t retardation{};                                      // Client response retardation.
     double score{};                                             // Client score.
 };
 
+// Worker thread hosting one of the concurrent games.
+// The acceptor reads load and open to pick the shard for a new connection.
+struct Shard {
+    Handoff handoff{};                          // Connections assigned by the acceptor.
+    Notifier* acceptor{};                       // Woken when the game reopens.
+    std::atomic<std::size_t> load{0};           // Connected and assigned clients.
+    std::atomic<bool> open{true};               // Whether the game accepts new players.
+    std::thread thread{};                       // Thread running the game.
+};
+
+// Current context/state of the server.
+struct ServerContext {
+    Config const& config;                   // Console parameters.
+    detail::Clock const& clock;             // Server clock.
+    EventLoop& loop;                        // Readiness notifications for all sockets.
+    CoeffFile const& file;                  // COEFF messages, shared by all games.
+    int sock;                               // Listening socket.
+    FdTable<Client> clients{};              // Connected clients by socket.
+    uint32_t received_puts{};               // Count of correct PUTs in the current game.
+    bool game_open{true};                   // Whether the game accepts connections and PUTs.
+    TimerQueue timers{};                    // Retarded responses and HELLO deadlines.
+    std::size_t pending_responses{};        // Count of awaiting responses of connected clients.
+    std::size_t output{};                   // Bytes queued for all clients of the game.
+    std::size_t output_cap{};               // Share of the global output cap, reading pauses above it.
+    bool output_paused{};                   // Whether reading is paused because output is over the cap.
+    uint64_t next_client_id{};              // Id for the next accepted client.
+    std::size_t next_coeff{};               // Line of the file for the next HELLO.
+    Shard* shard{};                         // Owning shard, nullptr in the single game mode.
+    UringLoop* uring{};                     // Same loop if it is io_uring, client sockets then use completions.
+    int metrics_sock{-1};                   // Metrics socket if served by this loop, -1 otherwise.
+    std::vector<Connection> parked{};       // Connections accepted by io_uring while the game was full.
+    Recorder* recorder{};                   // Session recording, nullptr if disabled.
+    Digest* replay{};                       // Output of a replay, nullptr when serving real sockets.
+};
+
 // Flag to determine whether the program should continue running.
-// Changed by catching SIGINT.
-static bool running = true;
+// Changed by catching SIGINT, read by all shards.
+static std::atomic<bool> running{true};
+
+// Flag to dump metrics to stderr, set by SIGUSR1.
+static std::atomic<bool> dump_requested{false};
+
+// Metrics of all games.
+static Metrics metrics;
+
+// Server output, written by a background thread.
+// Destroyed at exit, so output queued before fatal errors is written too.
+static AsyncLog server_log;
 
 // Print the usage message and exit the program.
 [[noreturn]] static void print_usage(char* progname) {
-    fatal("Usage: ", progname, " [-p <port>] [-k <K>] [-n <N>] [-m <M>] -f <file>");
+    fatal("Usage: ", progname, " [-p <port>] [-k <K>] [-n <N>] [-m <M>] [-e <poll|epoll|uring>] [-t <games>]",
+          " [-o <client output cap>] [-O <output cap>] [-M <metrics port>] [-R <recording> | -P <recording>] -f <file>");
 }
 
 // Cancel the while loop after receiving a signal.
@@ -61,16 +145,50 @@ static void catch_int([[maybe_unused]] int) {
     running = false;
 }
 
+// Request a metrics dump after receiving a signal.
+static void catch_usr1([[maybe_unused]] int) {
+    dump_requested = true;
+}
+
+// Start a line of the server log.
+static LogLine info() {
+    return LogLine(server_log);
+}
+
+// Route error messages through the server log.
+static void log_error(std::string const& text) {
+    server_log.write(STDERR_FILENO, text);
+}
+
+// Current time in microseconds, for wakeup durations.
+static int64_t now_us() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Current metrics in the text exposition format.
+static std::string metrics_text(detail::Clock const& clock) {
+    return format_metrics(metrics, clock.get_time(), server_log.dropped());
+}
+
+// Handle a pending SIGUSR1 by dumping metrics to stderr.
+static void check_dump_request(detail::Clock const& clock) {
+    if (dump_requested.exchange(false)) {
+        server_log.write(STDERR_FILENO, metrics_text(clock));
+    }
+}
+
 // Parse the program parameters.
 Config parse_args(int argc, char* argv[]) {
     detail::Clock clock{};
     Config config{};
 
-    bool p_given = false, k_given = false, n_given = false, m_given = false, f_given = false;
+    bool p_given = false, k_given = false, n_given = false, m_given = false, f_given = false, e_given = false,
+         t_given = false, M_given = false, R_given = false, P_given = false, o_given = false, O_given = false;
 
     opterr = 0;
     int opt;
-    while ((opt = getopt(argc, argv, "p:k:n:m:f:")) != -1) {
+    while ((opt = getopt(argc, argv, "p:k:n:m:f:e:t:M:R:P:o:O:")) != -1) {
         try {
             switch (opt) {
                 case 'p':
@@ -133,6 +251,85 @@ Config parse_args(int argc, char* argv[]) {
                     config.file_name = optarg;
                     f_given = true;
                     break;
+
+                case 'e':
+                    if (e_given) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.backend = parse_backend(optarg);
+                    e_given = true;
+                    break;
+
+                case 't':
+                    if (t_given) {
+                        print_usage(argv[0]);
+                    }
+
+                    // 0 means one game per core.
+                    config.shards = static_cast<unsigned>(std::stoul(optarg));
+                    if (config.shards == 0) {
+                        config.shards = std::max(std::thread::hardware_concurrency(), 1u);
+                    }
+                    if (config.shards > MAX_SHARDS) {
+                        fatal("Number of games must be between 0 and ", MAX_SHARDS);
+                    }
+
+                    t_given = true;
+                    break;
+
+                case 'M':
+                    if (M_given) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.metrics_port = detail::read_port(optarg);
+                    M_given = true;
+                    break;
+
+                case 'o':
+                    if (o_given) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.client_output_cap = std::stoull(optarg);
+                    if (config.client_output_cap < 1) {
+                        fatal("Client output cap must be positive");
+                    }
+
+                    o_given = true;
+                    break;
+
+                case 'O':
+                    if (O_given) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.output_cap = std::stoull(optarg);
+                    if (config.output_cap < 1) {
+                        fatal("Output cap must be positive");
+                    }
+
+                    O_given = true;
+                    break;
+
+                case 'R':
+                    if (R_given || P_given) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.record_file = optarg;
+                    R_given = true;
+                    break;
+
+                case 'P':
+                    if (P_given || R_given) {
+                        print_usage(argv[0]);
+                    }
+
+                    config.replay_file = optarg;
+                    P_given = true;
+                    break;
                 
                 default:
                     print_usage(argv[0]);
@@ -144,6 +341,8 @@ Config parse_args(int argc, char* argv[]) {
 
     if (!f_given) {
         fatal("-f option is required");
+    } else if ((R_given || P_given) && config.shards > 1) {
+        fatal("Recording and replaying require a single game");
     } else if (optind < argc) {
         fatal("Unexpected positional argument: ", argv[optind]);
     }
@@ -153,288 +352,477 @@ Config parse_args(int argc, char* argv[]) {
 
 // Disconnect client and delete any information about him.
 // Includes reverting puts submitted by client.
-static void disconnect_client(std::vector<pollfd>& fds, std::size_t i,
-                              std::map<int, Client>& client_map,
-                              uint32_t& received_puts) {
-    received_puts -= client_map[fds[i].fd].sent_puts;
-    client_map.erase(fds[i].fd);
-    close(fds[i].fd);
-    fds[i].fd = -1;
+static void disconnect_client(ServerContext& ctx, Client& client) {
+    int fd = client.fd;
+    ctx.received_puts -= client.sent_puts;
+    ctx.pending_responses -= client.pending_responses;
+    metrics.pending_responses.sub(client.pending_responses);
+    metrics.clients.sub();
+    ctx.output -= client.output;
+    metrics.output_bytes.sub(client.output);
+    if (client.throttled) {
+        metrics.throttled_clients.sub();
+    }
+    ctx.clients.erase(fd);
+
+    // Replayed clients have no sockets.
+    if (!ctx.replay) {
+        ctx.loop.remove(fd);
+        close(fd);
+    }
+
+    if (ctx.shard) {
+        --ctx.shard->load;
+    }
+}
+
+// Disconnect a client whose connection was closed by the peer or failed.
+// Recorded, unlike disconnects the server decides on, which replays repeat by themselves.
+static void drop_client(ServerContext& ctx, Client& client) {
+    if (ctx.recorder) {
+        ctx.recorder->close(ctx.clock.get_time(), client.fd);
+    }
+    disconnect_client(ctx, client);
 }
 
 // Print error message and change a referenced flag.
 // Used basically as a C macro.
-static void invalidate_message(Client& client, std::string const& message, bool& valid) {
+static void invalidate_message(Client& client, std::string_view message, bool& valid) {
     msg_error(client.ip_str, client.port, message, client.player_id);
     valid = false;
 }
 
-// Poll on sockets, return true if poll goes through.
-// Exit fatally if poll fails, return false if it was interrupted.
-static bool wait_on_poll(std::vector<pollfd>& fds, int64_t timeout) {
-    int poll_result = poll(fds.data(), fds.size(), timeout);
-    if (poll_result < 0) {
-        if (errno == EINTR) {
-            return false;
+// Account bytes queued for a client, until they are sent or the client leaves.
+static void add_output(ServerContext& ctx, Client& client, std::size_t size) {
+    client.output += size;
+    ctx.output += size;
+    metrics.output_bytes.add(size);
+}
+
+// Account bytes sent to a client.
+static void remove_output(ServerContext& ctx, Client& client, std::size_t size) {
+    client.output -= size;
+    ctx.output -= size;
+    metrics.output_bytes.sub(size);
+}
+
+// Whether reading from a client must wait until output drains.
+static bool output_full(ServerContext const& ctx, Client const& client) {
+    return client.output >= ctx.config.client_output_cap || ctx.output >= ctx.output_cap;
+}
+
+// Track whether a client is over its output cap.
+// A client that stays over the cap for OUTPUT_TIMEOUT gets disconnected.
+static void update_throttle(ServerContext& ctx, Client& client) {
+    bool over = client.output >= ctx.config.client_output_cap;
+    if (over == client.throttled) {
+        return;
+    }
+
+    client.throttled = over;
+    if (over) {
+        client.throttle_time = ctx.clock.get_time();
+        ctx.timers.push(client.throttle_time, OUTPUT_TIMEOUT, client.id, client.fd, TimerType::OUTPUT_TIMEOUT);
+        metrics.throttled_clients.add();
+        metrics.throttles.add();
+    } else {
+        metrics.throttled_clients.sub();
+    }
+}
+
+// Update the event loop interest of a client.
+// Reading is paused while the game is full or output is over the caps,
+// writing is needed only with pending data.
+// With io_uring receives are cancelled and resubmitted the same way.
+static void update_interest(ServerContext& ctx, Client& client) {
+    if (ctx.replay) {
+        return;
+    }
+
+    update_throttle(ctx, client);
+    bool reading = ctx.game_open && !client.throttled && !ctx.output_paused && !client.finished;
+
+    if (ctx.uring) {
+        if (reading && !client.receiving) {
+            ctx.uring->receive(client.fd);
+        } else if (!reading && client.receiving) {
+            ctx.uring->stop_receiving(client.fd);
         }
-        fatal("Poll failed.");
+        client.receiving = reading;
+        return;
     }
-    
-    return true;
+
+    uint32_t interest = 0;
+    if (reading) {
+        interest |= EVENT_READ;
+    }
+    if (!client.write_buffer.empty()) {
+        interest |= EVENT_WRITE;
+    }
+
+    ctx.loop.modify(client.fd, interest);
 }
 
-// Accept an incoming connection.
-// Reuse empty spaces in the given vector, push back if none found.
-static void accept_connection(Config const& config, std::vector<pollfd>& fds,
-                              std::map<int, Client>& client_map, detail::Clock const& clock) {
-    sockaddr_storage client_addr;
-    socklen_t addr_len = sizeof(client_addr);
+// Add an accepted connection to the game.
+static void register_client(ServerContext& ctx, int client_fd, sockaddr_storage const& client_addr) {
+    auto [ip_str, port] = detail::get_representation(client_addr);
+    info() << "New client [" << ip_str << "]:" << port << ".\n";
+    metrics.connections.add();
+    metrics.clients.add();
+
+    // Set the new client parameters and add it to client map.
+    Client new_client{};
+    new_client.connect_time = ctx.clock.get_time();
+    new_client.addr = client_addr;
+    new_client.fd = client_fd;
+    new_client.id = ctx.next_client_id++;
+    new_client.state.resize(ctx.config.k + 1, 0.0);
+    new_client.ip_str = std::move(ip_str);
+    new_client.port = port;
+    Client& client = ctx.clients.insert(client_fd, std::move(new_client));
+    if (ctx.recorder) {
+        ctx.recorder->connect(ctx.clock.get_time(), client_fd, client_addr);
+    }
 
-    int client_fd = accept(fds[0].fd,
-                            reinterpret_cast<sockaddr*>(&client_addr),
-                            &addr_len);
+    if (ctx.uring) {
+        ctx.uring->receive(client_fd);
+        client.receiving = true;
+    } else if (!ctx.replay) {
+        ctx.loop.add(client_fd, EVENT_READ);
+    }
 
-    if (client_fd < 0) {
-        syserr("Failed to accept new connection");
-    } else {
-        bool found = false;
-        for (std::size_t i = 1; i < fds.size(); ++i) {  // Try to reuse a pollfd structure.
-            if (fds[i].fd < 0) {
-                fds[i].fd = client_fd;
-                found = true;
-                break;
+    // Disconnect the client if no HELLO arrives in time.
+    ctx.timers.push(ctx.clock.get_time(), DISCONNECT_TIMEOUT + 1, client.id,
+                    client_fd, TimerType::HELLO_TIMEOUT);
+}
+
+// Accept all incoming connections waiting in the queue.
+static void accept_connections(ServerContext& ctx) {
+    while (true) {
+        sockaddr_storage client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+
+        int client_fd = accept(ctx.sock,
+                               reinterpret_cast<sockaddr*>(&client_addr),
+                               &addr_len);
+
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                syserr("Failed to accept new connection");
             }
-        }
 
-        // If no free pollfds, push a new one back.
-        if (!found) {
-            fds.push_back({client_fd, POLLIN | POLLOUT, 0});
+            return;
         }
 
-        auto [ip_str, port] = detail::get_representation(client_addr);
-        std::cout << "New client [" << ip_str << "]:" << port << ".\n";
+        register_client(ctx, client_fd, client_addr);
+    }
+}
 
-        // Set the new client parameters and add it to client map.
-        Client new_client{};
-        new_client.connect_time = clock.get_time();
-        new_client.addr = client_addr;
-        new_client.state.resize(config.k + 1, 0.0);
-        std::tie(new_client.ip_str, new_client.port) = detail::get_representation(client_addr);
-        client_map[client_fd] = std::move(new_client);
+// Add connections assigned to this shard by the acceptor.
+static void adopt_connections(ServerContext& ctx) {
+    for (Connection const& conn : ctx.shard->handoff.take()) {
+        register_client(ctx, conn.fd, conn.addr);
     }
 }
 
-// Check if poll detected any errors on given socket.
-// If so, disconnect appropriate client.
-// Returns true if no error occurred, false otherwise.
-static bool check_poll_error(std::vector<pollfd>& fds, std::size_t i,
-                             std::map<int, Client>& client_map,
-                             uint32_t& received_puts) {
+// Add connections accepted by io_uring, including ones parked while the game was full.
+static void adopt_parked(ServerContext& ctx) {
+    for (Connection const& conn : ctx.parked) {
+        register_client(ctx, conn.fd, conn.addr);
+    }
+    ctx.parked.clear();
+}
+
+// Hand the whole write buffer to io_uring, one send per client at a time.
+// Messages queued meanwhile go with the next send.
+static void submit_messages(ServerContext& ctx, Client& client) {
+    if (!client.sending && !client.write_buffer.empty()) {
+        client.sending = true;
+        ctx.uring->send(client.fd, client.write_buffer.take());
+    }
+}
 
-    Client& client = client_map[fds[i].fd];
-    if (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
-        std::cout << "Client [" << client.ip_str << "]:" << client.port << " disconnected.\n";
-        disconnect_client(fds, i, client_map, received_puts);
+// Disconnect a client of an ended game once its SCORING is sent.
+// Returns false if the client is disconnected.
+static bool check_finished(ServerContext& ctx, Client& client) {
+    if (client.finished && client.write_buffer.empty() && !client.sending) {
+        disconnect_client(ctx, client);
         return false;
     }
 
     return true;
 }
 
-// Read from a socket.
-// Closes the socket if errors occur.
-// Returns false if the read results in a disconnect.
-static bool receive_messages(std::vector<pollfd>& fds, std::size_t i,
-                             std::map<int, Client>& client_map,
-                             uint32_t& received_puts) {
-    char buffer[BUFFER_SIZE];
-    Client& client = client_map[fds[i].fd];
-
-    ssize_t received = recv(fds[i].fd, buffer, sizeof(buffer), 0);
-    if (received < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return true;
-        } else {
-            syserr("Failed to receive data from [", client.ip_str,
-                   "]:", client.port, ", closing connection.");
-            disconnect_client(fds, i, client_map, received_puts);
+// Write as much of the write buffer as the socket accepts without blocking.
+// Closes the socket if errors occur, or once a finished client is sent everything.
+// Returns false if the write results in a disconnect.
+static bool send_messages(ServerContext& ctx, Client& client) {
+    if (ctx.uring) {
+        submit_messages(ctx, client);
+        if (!check_finished(ctx, client)) {
             return false;
         }
-    } else if (received == 0) {
-        std::cout << "Client [" << client.ip_str << "]:" << client.port << " disconnected.\n";
-        disconnect_client(fds, i, client_map, received_puts);
-        return false;
-    } else {
-        client.read_buffer.append(buffer, received);
+        update_interest(ctx, client);
         return true;
+    } else if (ctx.replay) {
+        // Replayed peers accept everything at once.
+        for (std::string const& message : client.write_buffer.take()) {
+            ctx.replay->update(message);
+            remove_output(ctx, client, message.size());
+        }
+        return check_finished(ctx, client);
     }
-}
 
-// Write to socket.
-// Closes the socket if errors occur.
-// Returns false if the write results in a disconnect.
-static bool send_messages(std::vector<pollfd> fds, std::size_t i,
-                          std::map<int, Client>& client_map,
-                          uint32_t& received_puts) {
-    Client& client = client_map[fds[i].fd];
-    ssize_t sent = send(fds[i].fd, client.write_buffer.data(), client.write_buffer.size(), 0);
-    if (sent < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            sent = 0;
-            return false;
-        } else {
-            syserr("Failed to send data to [", client.ip_str, "]:", client.port, ", closing connection.");
-            disconnect_client(fds, i, client_map, received_puts);
-            return false;
+    while (!client.write_buffer.empty()) {
+        ssize_t sent = client.write_buffer.send(client.fd, MSG_DONTWAIT);
+        if (sent > 0) {
+            metrics.bytes_out.add(sent);
+            remove_output(ctx, client, sent);
+        } else if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else {
+                syserr("Failed to send data to [", client.ip_str, "]:", client.port, ", closing connection.");
+                drop_client(ctx, client);
+                return false;
+            }
         }
-    } else {
-        client.write_buffer.erase(0, sent);
-        return true;
     }
+
+    if (!check_finished(ctx, client)) {
+        return false;
+    }
+    update_interest(ctx, client);
+    return true;
 }
 
-// Add retarded messages to write buffer if they're eligible to be sent.
-static void process_retarded_messages(detail::Clock const& clock, Client& client) {
-    int64_t current_time = clock.get_time();
+// Schedule a retarded response to be sent to the client after delay.
+static void schedule_response(ServerContext& ctx, Client& client, int64_t delay, std::string message) {
+    add_output(ctx, client, message.size());
+    ctx.timers.push(ctx.clock.get_time(), delay, client.id, client.fd,
+                    TimerType::RESPONSE, std::move(message));
+    ++client.pending_responses;
+    ++ctx.pending_responses;
+    metrics.pending_responses.add();
+}
 
-    // Iterate over retarded messages.
-    for (auto it = client.retarded_responses.begin(); it != client.retarded_responses.end();) {
-        if (it->first <= current_time) {                // Current message should be sent already.
-            client.write_buffer += it->second;
-            it = client.retarded_responses.erase(it);
-        } else {                                        // Not ready to be sent yet.
-            ++it;
-        }
+// Fire all due timers: put ready responses in write buffers and send them,
+// disconnect clients that did not send HELLO in time.
+// Timers of clients that are already gone are dropped.
+static void process_timers(ServerContext& ctx) {
+    int64_t current_time = ctx.clock.get_time();
+    std::vector<int> ready_fds;
+
+    if (ctx.recorder && !ctx.timers.empty() && ctx.timers.next_deadline() <= current_time) {
+        ctx.recorder->tick(current_time);
     }
-}
 
-// Calculate the appropriate poll timeout according retarded messages,
-// currently waiting to be sent. Returns the number of messages waiting to be sent.
-static std::size_t calculate_timeout(int64_t& timeout, detail::Clock const& clock,
-                              std::map<int, Client> const& client_map) {
-    timeout = -1;
-    int64_t current_time = clock.get_time();
-    std::size_t retarded_count = 0;
+    while (!ctx.timers.empty() && ctx.timers.next_deadline() <= current_time) {
+        Timer timer = ctx.timers.pop();
+
+        Client* found = ctx.clients.find(timer.fd);
+        if (!found || found->id != timer.client_id) {
+            continue;
+        }
+        Client& client = *found;
 
-    // Iterate over retarded messages for all clients.
-    for (const auto& [_, client] : client_map) {
-        for (const auto& [time, _] : client.retarded_responses) {
-            ++retarded_count;
-            if (timeout < 0 || time - current_time < timeout) {     // Found a smaller necessary timeout.
-                timeout = time - current_time;
+        if (timer.type == TimerType::HELLO_TIMEOUT) {
+            if (!client.received_hello) {
+                err("Failed to receive 'HELLO' from [", client.ip_str, "]:", 
+                    client.port, ", closing connection.");
+                disconnect_client(ctx, client);
+            }
+            continue;
+        } else if (timer.type == TimerType::OUTPUT_TIMEOUT) {
+            // The client may have drained and refilled meanwhile, then a later timer decides.
+            // Clients of an ended game have OUTPUT_TIMEOUT to read their SCORING.
+            if (client.finished || (client.throttled && current_time - client.throttle_time >= OUTPUT_TIMEOUT)) {
+                err("Client [", client.ip_str, "]:", client.port, ", ", client.player_id,
+                    " doesn't read its messages, closing connection.");
+                metrics.output_overflows.add();
+                drop_client(ctx, client);
             }
+            continue;
         }
-    }
 
-    return retarded_count;
-}
+        client.write_buffer.push(std::move(timer.message));
+        --client.pending_responses;
+        --ctx.pending_responses;
+        metrics.pending_responses.sub();
 
-// End the game, send SCORING messages to all participants, 
-// disconnect all clients and reset the game state.
-static void end_game(Config const& config, std::vector<pollfd>& fds,
-                     std::map<int, Client>& client_map,
-                     uint32_t& received_puts) {
+        if (ready_fds.empty() || ready_fds.back() != client.fd) {
+            ready_fds.push_back(client.fd);
+        }
+    }
 
-    // Calculate the score of each client.
-    for (std::size_t i = 1; i < fds.size(); ++i) {
-        if (fds[i].fd >= 0) {
-            for (std::size_t j = 0; j <= config.k; ++j) {
-                double val = detail::poly_val(client_map[fds[i].fd].coeffs, j);
-                double dev = val - client_map[fds[i].fd].state[j];
-                client_map[fds[i].fd].score += (dev * dev);
-            }
+    // Send the responses right away.
+    for (int fd : ready_fds) {
+        Client* client = ctx.clients.find(fd);
+        if (client && !client->write_buffer.empty()) {
+            send_messages(ctx, *client);
         }
     }
+}
+
+// Calculate the appropriate poll timeout according to the earliest timer.
+static int64_t calculate_timeout(ServerContext const& ctx) {
+    if (ctx.timers.empty()) {
+        return -1;
+    }
 
+    return std::max<int64_t>(ctx.timers.next_deadline() - ctx.clock.get_time(), 0);
+}
+
+// End the game, queue SCORING messages to all participants and reset the game state.
+// Participants are disconnected once their SCORING is sent, or after OUTPUT_TIMEOUT,
+// clients of a previous game that are still being sent theirs take no part.
+static void end_game(ServerContext& ctx) {
     // Get the score of each client along its name and sort the result.
+    // Deviations are kept up to date with every PUT, they are added to the penalties in point order.
     std::vector<std::pair<std::string, double>> scoring;
-    for (const auto& [fd, client] : client_map) {
-        scoring.emplace_back(client.player_id, client.score);
-    }
+    scoring.reserve(ctx.clients.size());
+    ctx.clients.for_each([&](Client& client) {
+        if (!client.finished) {
+            for (double error : client.errors) {
+                client.score += error;
+            }
+            scoring.emplace_back(client.player_id, client.score);
+        }
+    });
     std::sort(scoring.begin(), scoring.end());
 
-    std::cout << "Game end, scoring:";
+    LogLine line = info();
+    line << "Game end, scoring:";
     for (const auto& [player, score] : scoring) {
-        std::cout << " " << player << " "
-                    << std::fixed << std::setprecision(7) << score;
+        std::string text;
+        append_value(text, score);
+        line << " " << player << " " << text;
     }
-    std::cout <<".\n";
+    line << ".\n";
+    metrics.games.add();
 
-    // Send SCORING message to all clients.
+    // Send SCORING message to all clients, their PUTs no longer count towards a game.
     std::string scoring_message = build_scoring(scoring);
-    for (std::size_t i = 1; i < fds.size(); ++i) {
-        if (fds[i].fd < 0) {
+    std::string scoring_frame = encode_scoring(scoring);
+    for (int fd : ctx.clients.keys()) {
+        Client& client = *ctx.clients.find(fd);
+        if (client.finished) {
             continue;
         }
 
-        send(fds[i].fd, scoring_message.data(), scoring_message.size(), 0);
-        disconnect_client(fds, i, client_map, received_puts);
+        ctx.received_puts -= client.sent_puts;
+        client.sent_puts = 0;
+        client.finished = true;
+
+        std::string message = client.binary ? scoring_frame : scoring_message;
+        add_output(ctx, client, message.size());
+        client.write_buffer.push(std::move(message));
+        if (send_messages(ctx, client)) {
+            ctx.timers.push(ctx.clock.get_time(), OUTPUT_TIMEOUT, client.id, fd, TimerType::OUTPUT_TIMEOUT);
+        }
     }
 }
 
 // Handle a HELLO message, return false if message is invalid.
-static bool handle_hello(std::string const& message, Client& client,
-                         bool& valid, std::ifstream& file) {
-    if (!validate_hello(message) || client.received_hello) {
+static bool handle_hello(ServerContext& ctx, std::string_view message,
+                         Client& client, bool& valid) {
+    HelloOptions options;
+    auto player_id = scan_hello(message, options);
+
+    if (!player_id.has_value() || client.received_hello) {
         invalidate_message(client, message, valid);
         return false;
     } else {
-        client.player_id = parse_hello(message);
+        client.player_id = player_id.value();
         client.received_hello = true;
+        client.binary = options.binary;
+        client.delta = options.delta;
         client.retardation = detail::count_lowercase(client.player_id) * 1000;
 
-        std::cout << client.ip_str << ":" << client.port << " is now known as " 
-                  << client.player_id << ".\n";
+        info() << client.ip_str << ":" << client.port << " is now known as "
+               << client.player_id << ".\n";
         
-        // Get the COEFF message from given file.
-        std::string coeff_message;
-        std::getline(file, coeff_message);
-        coeff_message += '\n';
-        client.write_buffer += coeff_message;
-
-        client.coeffs = parse_coeff(coeff_message.substr(0, coeff_message.size() - 2));
-        std::cout << client.player_id << " get coefficients:";
-        for (const auto& coeff : client.coeffs) {
-            std::cout  << " " << std::fixed << std::setprecision(7) << coeff;
-        }
-        std::cout << ".\n";
+        // Take the next COEFF message of the file, parsed at startup.
+        std::size_t index = ctx.next_coeff++;
+        auto coeffs = ctx.file.coeffs(index);
+        client.coeffs.assign(coeffs.begin(), coeffs.end());
+        std::string coeff = client.binary ? encode_values(MessageType::COEFF, client.coeffs)
+                                          : std::string(ctx.file.line(index)) + '\n';
+        add_output(ctx, client, coeff.size());
+        client.write_buffer.push(std::move(coeff));
+
+        // Cache the polynomial values, the state is still zero, so they are the deviations.
+        client.values = detail::poly_vals(client.coeffs, 0, ctx.config.k + 1);
+        client.errors.resize(ctx.config.k + 1);
+        for (std::size_t j = 0; j <= ctx.config.k; ++j) {
+            double dev = client.values[j] - client.state[j];
+            client.errors[j] = dev * dev;
+        }
+
+        std::string coeff_text;
+        append_values(coeff_text, client.coeffs);
+        info() << client.player_id << " get coefficients:" << coeff_text << ".\n";
         return true;
     }
 }
 
+// Build a PENALTY or BAD_PUT response in the client's framing.
+// Text clients get the PUT arguments back as they sent them.
+static std::string build_rejection(Client const& client, MessageType type, std::string_view args,
+                                   std::optional<std::pair<int16_t, double>> const& put) {
+    if (client.binary && put.has_value()) {
+        return encode_point_value(type, put->first, put->second);
+    }
+
+    return (type == MessageType::PENALTY ? "PENALTY " : "BAD_PUT ") + std::string(args) + DELIMITER;
+}
+
+// Build a full STATE in the client's framing.
+static std::string build_full_state(Client& client) {
+    client.deltas = 0;
+    return client.binary ? encode_values(MessageType::STATE, client.state) : build_state(client.state);
+}
+
+// Build the response to an accepted PUT at point.
+// Clients using STATE_DELTA get the new value at the point only, except for
+// their first response and every STATE_SYNC_INTERVAL-th one, which are full STATEs.
+static std::string build_put_response(Client& client, int16_t point) {
+    if (!client.delta || client.sent_puts == 1 || client.deltas + 1 >= STATE_SYNC_INTERVAL) {
+        return build_full_state(client);
+    }
+
+    ++client.deltas;
+    std::vector<std::pair<int16_t, double>> changes{{point, client.state[point]}};
+    return client.binary ? encode_point_values(MessageType::STATE_DELTA, changes) : build_state_delta(changes);
+}
+
 // Handle a PUT message, return false if message is invalid or unexpected.
-static bool handle_put(std::string const& message, Client& client,
-                       bool& valid, detail::Clock const& clock,
-                       Config const& config, uint32_t& received_puts) {
+// put is std::nullopt if the message does not match the grammar,
+// args are the PUT arguments as sent.
+static bool handle_put(ServerContext& ctx, std::string_view message, std::string_view args,
+                       std::optional<std::pair<int16_t, double>> const& put,
+                       Client& client, bool& valid) {
     bool bad_put = false;
 
-    // PENALTY necessary.
-    auto it = client.retarded_responses.lower_bound(clock.get_time());
-    if (!client.received_hello || 
-            (it == client.retarded_responses.begin() && !client.retarded_responses.empty())) {
+    // PENALTY necessary: due responses are sent before handling messages,
+    // so any awaiting response has not been delivered yet.
+    if (!client.received_hello || client.pending_responses > 0) {
         invalidate_message(client, message, valid);
-        std::string penalty_message = "PENALTY "
-                                    + message.substr(PUT_SIZE)
-                                    + "\r\n";
-
-        client.retarded_responses.insert(
-            {clock.get_time(), penalty_message}
-        );
+        schedule_response(ctx, client, 0, build_rejection(client, MessageType::PENALTY, args, put));
+        metrics.penalties.add();
 
         client.score += 20;
     }
 
-    // BAD_PUT necessary: regex match failed.
-    if (!validate_put(message)) {
+    // BAD_PUT necessary: message does not match the grammar.
+    if (!put.has_value()) {
         invalidate_message(client, message, valid);
-
-        std::string bad_put_message = "BAD_PUT "
-                                    + message.substr(PUT_SIZE)
-                                    + "\r\n";
-        
-        client.retarded_responses.insert(
-            {clock.get_time() + 1000, bad_put_message}
-        );
+        schedule_response(ctx, client, BAD_PUT_DELAY, build_rejection(client, MessageType::BAD_PUT, args, put));
+        metrics.bad_puts.add();
         
         client.score += 10;
         bad_put = true;
@@ -442,36 +830,35 @@ static bool handle_put(std::string const& message, Client& client,
 
     // No BAD_PUT detected yet.
     if (!bad_put) {
-        auto [point, value] = parse_put(message);
+        auto [point, value] = put.value();
 
         // BAD_PUT necessary: out of bounds values.
-        if (point < 0 || point > config.k || value < -5.0 || value > 5.0) {
+        if (point < 0 || point > ctx.config.k || value < -5.0 || value > 5.0) {
             invalidate_message(client, message, valid);
-            std::string bad_put_message = "BAD_PUT "
-                                        + message.substr(PUT_SIZE)
-                                        + "\r\n";
-            
-            client.retarded_responses.insert(
-                {clock.get_time() + 1000, bad_put_message}
-            );
+            schedule_response(ctx, client, BAD_PUT_DELAY, build_rejection(client, MessageType::BAD_PUT, args, put));
+            metrics.bad_puts.add();
             
             client.score += 10;
         } else if (valid) {     // Correct PUT.
             ++client.sent_puts;
-            ++received_puts;
+            ++ctx.received_puts;
+            metrics.puts.add();
+
+            // Replace the squared deviation at the point.
             client.state[point] += value;
+            double dev = client.values[point] - client.state[point];
+            client.errors[point] = dev * dev;
 
-            std::cout << client.player_id << " puts " << std::fixed << std::setprecision(7)
-                    << value << " in " << point << ", current state:";
-            for (const auto& val : client.state) {
-                std::cout << " " << std::fixed << std::setprecision(7) << val;
-            }
-            std::cout << ".\n";
+            // Format values once for the whole line, streams are slow with large K.
+            std::string text;
+            text.reserve((client.state.size() + 1) * 12);
+            text += " puts ";
+            append_value(text, value);
+            text += " in " + std::to_string(point) + ", current state:";
+            append_values(text, client.state);
+            info() << client.player_id << text << ".\n";
 
-            client.retarded_responses.insert(
-                {clock.get_time() + client.retardation,
-                build_state(client.state)}
-            );
+            schedule_response(ctx, client, client.retardation, build_put_response(client, point));
 
             return true;
         }
@@ -480,30 +867,83 @@ static bool handle_put(std::string const& message, Client& client,
     return false;
 }
 
+// Handle a request for a full STATE, return false if it is invalid or unexpected.
+// Only clients using STATE_DELTA may ask, the response is delayed like a PUT's.
+static bool handle_state_request(ServerContext& ctx, std::string_view message, bool request,
+                                 Client& client, bool& valid) {
+    if (!request || !client.received_hello || !client.delta) {
+        invalidate_message(client, message, valid);
+        return false;
+    }
+
+    schedule_response(ctx, client, client.retardation, build_full_state(client));
+    return true;
+}
+
+// Handle a binary frame, PUTs and STATE requests are expected.
+// Frames that don't decode are reported without a response, as there is nothing to echo.
+static void handle_frame(ServerContext& ctx, Frame const& frame, Client& client, bool& valid) {
+    if (frame.type == MessageType::STATE) {
+        handle_state_request(ctx, describe_frame(frame), frame.payload.empty(), client, valid);
+        return;
+    }
+
+    std::optional<std::pair<int16_t, double>> put;
+    if (frame.type == MessageType::PUT) {
+        put = decode_point_value(frame.payload);
+    }
+
+    if (!put.has_value()) {
+        invalidate_message(client, describe_frame(frame), valid);
+        return;
+    }
+
+    handle_put(ctx, "<binary PUT frame>", {}, put, client, valid);
+}
+
 // Parse received messages in a loop.
-static bool parse_loop(std::vector<pollfd>& fds, std::size_t i,
-                       Config const& config, std::ifstream& file,
-                       std::map<int, Client>& client_map,
-                       uint32_t& received_puts, detail::Clock const& clock) {
-
-    Client& client = client_map[fds[i].fd];
-    while (received_puts < config.m) {
-        auto line = extract_line(client.read_buffer);
+// Returns false if parsing results in a disconnect.
+static bool parse_loop(ServerContext& ctx, Client& client) {
+    while (!client.finished && ctx.received_puts < ctx.config.m) {
+        bool valid = true;
+
+        // After a binary HELLO the rest of the stream is framed.
+        if (client.binary) {
+            bool malformed = false;
+            auto frame = next_frame(client.read_buffer, malformed);
+            if (malformed) {
+                err("Malformed frame from [", client.ip_str, "]:", client.port, ", ",
+                    client.player_id, ", closing connection.");
+                disconnect_client(ctx, client);
+                return false;
+            } else if (!frame.has_value()) {
+                break;
+            }
+
+            handle_frame(ctx, frame.value(), client, valid);
+            continue;
+        }
+
+        auto line = client.read_buffer.next_line();
         if (!line.has_value()) {
             break;
         }
 
-        std::string message = line.value();
+        std::string_view message = line.value();
         MessageType type = get_message_type(message);
-        bool valid = true;
 
         switch (type) {
             case MessageType::HELLO:
-                handle_hello(message, client, valid, file);
+                handle_hello(ctx, message, client, valid);
 
                 break;
             case MessageType::PUT:
-                handle_put(message, client, valid, clock, config, received_puts);
+                handle_put(ctx, message, message.substr(std::min(PUT_SIZE, message.size())), scan_put(message),
+                           client, valid);
+
+                break;
+            case MessageType::STATE:
+                handle_state_request(ctx, message, scan_state_request(message), client, valid);
 
                 break;
             default:
@@ -514,7 +954,7 @@ static bool parse_loop(std::vector<pollfd>& fds, std::size_t i,
         if (!valid && !client.received_hello) {
             err("Invalid first message from [", client.ip_str, "]:", client.port, ", ",
                 client.player_id, ": ", message, ", closing connection.");
-            disconnect_client(fds, i, client_map, received_puts);
+            disconnect_client(ctx, client);
             return false;
         }
     }
@@ -522,95 +962,479 @@ static bool parse_loop(std::vector<pollfd>& fds, std::size_t i,
     return true;
 }
 
-// Main server control loop.
-static void run_server(Config const& config, std::vector<pollfd> fds,
-                       std::map<int, Client> client_map, detail::Clock const& clock,
-                       uint32_t& received_puts, std::ifstream& file) {
+// Read from a socket until it would block, parsing messages after each chunk.
+// Closes the socket if errors occur.
+// Returns false if the read results in a disconnect.
+static bool receive_messages(ServerContext& ctx, Client& client) {
+    while (ctx.received_puts < ctx.config.m && !output_full(ctx, client)) {
+        char* buffer = client.read_buffer.write_area(BUFFER_SIZE);
+        ssize_t received = recv(client.fd, buffer, BUFFER_SIZE, MSG_DONTWAIT);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            } else {
+                syserr("Failed to receive data from [", client.ip_str,
+                       "]:", client.port, ", closing connection.");
+                drop_client(ctx, client);
+                return false;
+            }
+        } else if (received == 0) {
+            info() << "Client [" << client.ip_str << "]:" << client.port << " disconnected.\n";
+            drop_client(ctx, client);
+            return false;
+        }
 
-    // Block on poll, skip non fatal errors.
+        metrics.bytes_in.add(received);
+        if (ctx.recorder) {
+            ctx.recorder->data(ctx.clock.get_time(), client.fd, std::string_view(buffer, received));
+        }
+        client.read_buffer.commit(received);
+        if (!parse_loop(ctx, client)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Handle a readiness event on a client socket.
+static void handle_client_event(ServerContext& ctx, Event const& event) {
+    Client* found = ctx.clients.find(event.fd);
+    if (!found) {   // Client disconnected earlier in this batch.
+        return;
+    }
+    Client& client = *found;
+
+    // Socket errors result in a disconnect.
+    if (event.flags & EVENT_ERROR) {
+        info() << "Client [" << client.ip_str << "]:" << client.port << " disconnected.\n";
+        drop_client(ctx, client);
+        return;
+    }
+
+    // If the game still lasts, read and parse messages from client.
+    if (ctx.received_puts < ctx.config.m && (event.flags & EVENT_READ)) {
+        if (!receive_messages(ctx, client)) {
+            return;
+        }
+    }
+
+    // Send messages.
+    if (!client.write_buffer.empty()) {
+        send_messages(ctx, client);
+    }
+}
+
+// Handle a socket operation completed by io_uring.
+// Accepted connections are parked until the end of the wakeup, like readiness of the listening socket.
+static void handle_completion(ServerContext& ctx, Completion const& completion) {
+    if (completion.type == CompletionType::ACCEPT) {
+        if (completion.result < 0) {
+            errno = -completion.result;
+            syserr("Failed to accept new connection");
+            return;
+        }
+
+        Connection conn{completion.result, {}};
+        socklen_t addr_len = sizeof(conn.addr);
+        getpeername(conn.fd, reinterpret_cast<sockaddr*>(&conn.addr), &addr_len);
+        ctx.parked.push_back(conn);
+        return;
+    }
+
+    Client* found = ctx.clients.find(completion.fd);
+    if (!found) {   // Client disconnected earlier in this batch.
+        return;
+    }
+    Client& client = *found;
+
+    if (completion.type == CompletionType::RECV) {
+        if (completion.result == 0) {
+            info() << "Client [" << client.ip_str << "]:" << client.port << " disconnected.\n";
+            drop_client(ctx, client);
+            return;
+        } else if (completion.result < 0) {
+            errno = -completion.result;
+            syserr("Failed to receive data from [", client.ip_str,
+                   "]:", client.port, ", closing connection.");
+            drop_client(ctx, client);
+            return;
+        }
+
+        metrics.bytes_in.add(completion.result);
+        if (ctx.recorder) {
+            ctx.recorder->data(ctx.clock.get_time(), client.fd, completion.data);
+        }
+        client.read_buffer.append(completion.data);
+        if (ctx.received_puts < ctx.config.m && !parse_loop(ctx, client)) {
+            return;
+        }
+    } else {
+        client.sending = false;
+        if (completion.result < 0) {
+            errno = -completion.result;
+            syserr("Failed to send data to [", client.ip_str, "]:", client.port, ", closing connection.");
+            drop_client(ctx, client);
+            return;
+        }
+
+        metrics.bytes_out.add(completion.result);
+        remove_output(ctx, client, completion.result);
+    }
+
+    send_messages(ctx, client);
+}
+
+// Pause or resume reading from all sockets when the game fills up or
+// frees up after a disconnect. Buffered messages are parsed on resume.
+static void update_game_state(ServerContext& ctx) {
+    bool open = ctx.received_puts < ctx.config.m;
+    if (open == ctx.game_open) {
+        return;
+    }
+
+    ctx.game_open = open;
+    if (ctx.shard) {
+        // Connections assigned while the game was full are adopted in the next iteration.
+        ctx.shard->open = open;
+        if (open) {
+            ctx.shard->handoff.notifier().notify();
+            ctx.shard->acceptor->notify();
+        }
+    } else if (!ctx.uring && !ctx.replay) {
+        ctx.loop.modify(ctx.sock, open ? EVENT_READ : 0);
+    }
+
+    for (int fd : ctx.clients.keys()) {
+        Client& client = *ctx.clients.find(fd);
+        if (open && !parse_loop(ctx, client)) {
+            continue;
+        }
+        update_interest(ctx, client);
+    }
+}
+
+// Pause or resume reading from all clients when the output of the game
+// goes over its share of the output cap or drains below it.
+static void update_output_state(ServerContext& ctx) {
+    bool paused = ctx.output >= ctx.output_cap;
+    if (paused == ctx.output_paused || ctx.replay) {
+        return;
+    }
+
+    ctx.output_paused = paused;
+    if (paused) {
+        metrics.paused_games.add();
+    } else {
+        metrics.paused_games.sub();
+    }
+
+    for (int fd : ctx.clients.keys()) {
+        update_interest(ctx, *ctx.clients.find(fd));
+    }
+}
+
+// Steps closing every wakeup, after all events are handled.
+static void finish_wakeup(ServerContext& ctx) {
+    // End the game if enough PUTs went through and no messages await.
+    if (ctx.received_puts == ctx.config.m && ctx.pending_responses == 0) {
+        end_game(ctx);
+    }
+
+    update_game_state(ctx);
+    update_output_state(ctx);
+    if (ctx.recorder) {
+        ctx.recorder->end_wakeup();
+    }
+}
+
+// Main server control loop.
+static void run_server(ServerContext& ctx) {
+    std::vector<Event> events;
     int64_t timeout = -1;
+
     while (running) {
-        if (!wait_on_poll(fds, timeout)) {
+        check_dump_request(ctx.clock);
+
+        // Block until sockets are ready or the next deadline passes, skip non fatal errors.
+        if (!ctx.loop.wait(timeout, events)) {
             continue;
         }
 
-        // If the game still lasts and a client is waiting, accept his connection.
-        if (received_puts < config.m && (fds[0].revents & POLLIN)) {
-            accept_connection(config, fds, client_map, clock);
+        int64_t wakeup_time = now_us();
+        metrics.wakeups.add();
+        metrics.wakeup_events.observe(events.size() + (ctx.uring ? ctx.uring->completions().size() : 0));
+
+        // Send due retarded responses and drop clients without HELLO.
+        process_timers(ctx);
+
+        // Handle socket operations completed by io_uring.
+        if (ctx.uring) {
+            for (auto const& completion : ctx.uring->completions()) {
+                handle_completion(ctx, completion);
+            }
         }
 
-        // Iterate over clients.
-        for (std::size_t i = 1; i < fds.size(); ++i) {
-            // Empty socket, skip iteration.
-            if (fds[i].fd < 0) {
-                continue;
+        // Handle ready clients only.
+        bool accept_pending = false;
+        for (auto const& event : events) {
+            if (event.fd == ctx.sock) {
+                accept_pending = true;
+            } else if (event.fd == ctx.metrics_sock) {
+                serve_metrics(ctx.metrics_sock, metrics_text(ctx.clock));
+            } else if (ctx.shard && event.fd == ctx.shard->handoff.notifier().fd()) {
+                ctx.shard->handoff.notifier().clear();
+                accept_pending = true;
+            } else {
+                handle_client_event(ctx, event);
             }
+        }
 
-            // Check for poll errors, they will result in a disconnect, so skip iteration.
-            if (!check_poll_error(fds, i, client_map, received_puts)) {
-                continue;
+        // If the game still lasts, accept waiting clients. Done after handling the events,
+        // so that a stale event can't refer to a reused descriptor.
+        if (!ctx.parked.empty() && ctx.received_puts < ctx.config.m) {
+            adopt_parked(ctx);
+        }
+        if (accept_pending && ctx.received_puts < ctx.config.m) {
+            if (ctx.shard) {
+                adopt_connections(ctx);
+            } else {
+                accept_connections(ctx);
             }
-            
-            // If the game still lasts, read messages from client.
-            // Errors will result in a disconnect, so skip iteration.
-            if (received_puts < config.m && (fds[i].revents & POLLIN)) {
-                if (receive_messages(fds, i, client_map, received_puts)) {
-                    continue;
+        }
+
+        finish_wakeup(ctx);
+        timeout = calculate_timeout(ctx);
+        metrics.wakeup_us.observe(now_us() - wakeup_time);
+    }
+}
+
+// Feed a recording through the handlers of run_server with the clock set to each
+// recorded time, as fast as possible. Prints the replay speed and a digest of all
+// output, which must not change unless the server behaviour does.
+static void run_replay(Config const& config, detail::Clock& clock, CoeffFile const& file) {
+    RecordingReader reader(config.replay_file);
+    Config replay_config = config;
+    replay_config.k = reader.header().k;
+    replay_config.n = reader.header().n;
+    replay_config.m = reader.header().m;
+
+    PollLoop loop;
+    Digest output;
+    ServerContext ctx{replay_config, clock, loop, file, -1};
+    ctx.output_cap = config.output_cap;
+    ctx.replay = &output;
+
+    uint64_t records = 0, wakeups = 0;
+    int64_t start = now_us();
+    Record record;
+    while (running && reader.next(record)) {
+        ++records;
+        clock.set_time(record.time);
+
+        switch (record.type) {
+            case RecordType::CONNECT:
+                register_client(ctx, record.fd, record.addr);
+                break;
+
+            case RecordType::DATA:
+                // Data of clients the server has already dropped is ignored, like on a closed socket.
+                if (Client* client = ctx.clients.find(record.fd)) {
+                    metrics.bytes_in.add(record.data.size());
+                    client->read_buffer.append(record.data);
+                    if (ctx.received_puts < ctx.config.m) {
+                        parse_loop(ctx, *client);
+                    }
                 }
-            }
+                break;
 
-            // Parse received messages. If the first message is invalid, it will result
-            // in a disconnect, so skip iteration.
-            if (!parse_loop(fds, i, config, file, client_map, received_puts, clock)) {
-                continue;
-            }
+            case RecordType::CLOSE:
+                if (Client* client = ctx.clients.find(record.fd)) {
+                    info() << "Client [" << client->ip_str << "]:" << client->port << " disconnected.\n";
+                    disconnect_client(ctx, *client);
+                }
+                break;
 
-            // Process retarded responses and put ready ones in write buffer.
-            if (fds[i].fd > 0) {
-                process_retarded_messages(clock, client_map[fds[i].fd]);
-            }
+            case RecordType::TICK:
+                process_timers(ctx);
+                break;
 
-            // If no HELLO message arrives in a given interval after connection, disconnect and skip iteration.
-            if (clock.get_time() > client_map[fds[i].fd].connect_time + DISCONNECT_TIMEOUT &&
-                !client_map[fds[i].fd].received_hello && fds[i].fd > 0) {
-                
-                err("Failed to receive 'HELLO' from [", client_map[fds[i].fd].ip_str, "]:", 
-                       client_map[fds[i].fd].port, ", closing connection.");
-                disconnect_client(fds, i, client_map, received_puts);
+            case RecordType::WAKEUP_END:
+                ++wakeups;
+                finish_wakeup(ctx);
+                break;
+        }
+    }
+    int64_t elapsed = std::max<int64_t>(now_us() - start, 1);
+
+    info() << "Replayed " << records << " records in " << wakeups << " wakeups in "
+           << std::fixed << std::setprecision(3) << elapsed / 1000.0 << " ms ("
+           << records * 1000000.0 / elapsed << " records/s).\n";
+    info() << "Output: " << output.size() << " bytes, digest " << std::hex << std::setw(16)
+           << std::setfill('0') << output.value() << ".\n";
+
+    for (int fd : ctx.clients.keys()) {
+        disconnect_client(ctx, *ctx.clients.find(fd));
+    }
+}
+
+// Close open connections, including ones assigned but not adopted yet.
+static void close_connections(ServerContext& ctx) {
+    for (int fd : ctx.clients.keys()) {
+        disconnect_client(ctx, *ctx.clients.find(fd));
+    }
+
+    for (Connection const& conn : ctx.parked) {
+        close(conn.fd);
+    }
+
+    if (ctx.shard) {
+        for (Connection const& conn : ctx.shard->handoff.take()) {
+            close(conn.fd);
+        }
+    }
+}
+
+// Worker thread running one of the concurrent games.
+// Each game reads the COEFF file from the beginning with its own cursor.
+static void run_shard(Config const& config, detail::Clock const& clock, CoeffFile const& file, Shard& shard) {
+    std::unique_ptr<EventLoop> loop = make_event_loop(config.backend);
+    loop->add(shard.handoff.notifier().fd(), EVENT_READ);
+
+    ServerContext ctx{config, clock, *loop, file, -1};
+    ctx.output_cap = std::max<std::size_t>(config.output_cap / config.shards, 1);
+    ctx.uring = dynamic_cast<UringLoop*>(loop.get());
+    ctx.shard = &shard;
+
+    run_server(ctx);
+    close_connections(ctx);
+}
+
+// Pick the least loaded shard with an open game, nullptr if all games are full.
+static Shard* pick_shard(std::vector<std::unique_ptr<Shard>> const& shards) {
+    Shard* best = nullptr;
+    for (auto const& shard : shards) {
+        if (shard->open && (!best || shard->load < best->load)) {
+            best = shard.get();
+        }
+    }
+
+    return best;
+}
+
+// Accept incoming connections and assign each to the least loaded open game.
+// Returns false if connections are left in the queue, because all games are full.
+static bool accept_into_shards(int sock, std::vector<std::unique_ptr<Shard>> const& shards) {
+    while (true) {
+        Shard* shard = pick_shard(shards);
+        if (!shard) {
+            return false;
+        }
+
+        sockaddr_storage client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+
+        int client_fd = accept(sock, reinterpret_cast<sockaddr*>(&client_addr), &addr_len);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
                 continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                syserr("Failed to accept new connection");
             }
-            
-            // Send messages.
-            if (!client_map[fds[i].fd].write_buffer.empty() && (fds[i].revents & POLLOUT)) {
-                if (!send_messages(fds, i, client_map, received_puts)) {
-                    continue;
-                }
-            }
+
+            return true;
         }
 
-        // Calculate current poll timeout and count awaiting responses.
-        std::size_t retarded_count = calculate_timeout(timeout, clock, client_map);
+        ++shard->load;
+        shard->handoff.push({client_fd, client_addr});
+    }
+}
 
-        // End the game if enough PUTs went through and no messages await.
-        if (received_puts == config.m && retarded_count == 0) {
-            end_game(config, fds, client_map, received_puts);
+// Acceptor loop of the multi-game mode, runs on the main thread.
+// Accepting pauses while all games are full, a reopening game wakes the acceptor.
+// Metrics are served and dumped here, as the acceptor is the thread handling signals.
+static void run_acceptor(Config const& config, detail::Clock const& clock, int sock, int metrics_sock,
+                         Notifier& wakeup, std::vector<std::unique_ptr<Shard>> const& shards) {
+    std::unique_ptr<EventLoop> loop = make_event_loop(config.backend);
+    loop->add(sock, EVENT_READ);
+    loop->add(wakeup.fd(), EVENT_READ);
+    if (metrics_sock >= 0) {
+        loop->add(metrics_sock, EVENT_READ);
+    }
+
+    std::vector<Event> events;
+    while (running) {
+        check_dump_request(clock);
+        if (!loop->wait(-1, events)) {
+            continue;
         }
+
+        for (auto const& event : events) {
+            if (event.fd == wakeup.fd()) {
+                wakeup.clear();
+            } else if (event.fd == metrics_sock) {
+                serve_metrics(metrics_sock, metrics_text(clock));
+            }
+        }
+
+        bool accepting = accept_into_shards(sock, shards);
+        loop->modify(sock, accepting ? EVENT_READ : 0);
+    }
+}
+
+// Host config.shards independent games, each on its own thread with its own event loop.
+static void run_sharded(Config const& config, detail::Clock const& clock, CoeffFile const& file,
+                        int sock, int metrics_sock) {
+    Notifier wakeup;
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    // Only the acceptor handles SIGINT and SIGUSR1, workers inherit the blocked mask.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    for (unsigned i = 0; i < config.shards; ++i) {
+        auto shard = std::make_unique<Shard>();
+        shard->acceptor = &wakeup;
+        shard->thread = std::thread(run_shard, std::cref(config), std::cref(clock), std::cref(file),
+                                    std::ref(*shard));
+        shards.push_back(std::move(shard));
+    }
+
+    pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+
+    run_acceptor(config, clock, sock, metrics_sock, wakeup, shards);
+
+    // Wake the workers, so they notice the stop.
+    for (auto& shard : shards) {
+        shard->handoff.notifier().notify();
+        shard->thread.join();
     }
 }
 
 int main(int argc, char *argv[]) {
+    // All output goes through the asynchronous log.
+    err_util::write_error = log_error;
+
     // Parse the command line arguments and initiate internal clock.
     Config config = parse_args(argc, argv);
     detail::Clock clock{};
 
-    // Install a handler for SIGINT and disable cout buffering.
+    // Install handlers for SIGINT and SIGUSR1. The latter must interrupt waits.
     detail::install_signal_handler(SIGINT, catch_int, SA_RESTART);
-    std::cout.setf(std::ios::unitbuf);
+    detail::install_signal_handler(SIGUSR1, catch_usr1, 0);
+
+    // Map and index the file containing COEFF messages.
+    CoeffFile file(config.file_name);
 
-    // Open the file containing COEFF messages.
-    std::ifstream file(config.file_name);
-    if (!file.is_open()) {
-        fatal("Failed to open file.");
+    // Replays need no sockets.
+    if (!config.replay_file.empty()) {
+        run_replay(config, clock, file);
+        return 0;
     }
 
     // Create an appropriate socket and extract the bind port if OS assigned.
@@ -624,26 +1448,61 @@ int main(int argc, char *argv[]) {
         fatal("Failed to listen on socket.");
     }
 
-    std::cout << "Listening on port " << config.port << "\n";
-
-    std::map<int, Client> client_map;
-    std::vector<pollfd> fds{1};
-    uint32_t received_puts = 0;
+    info() << "Listening on port " << config.port << "\n";
+    if (config.shards > 1) {
+        info() << "Hosting " << config.shards << " concurrent games\n";
+    }
 
-    // Setup the poll structure.
-    fds[0].fd = sock;
-    fds[0].events = POLLIN;
+    // Serve metrics on the loopback interface if requested.
+    int metrics_sock = -1;
+    if (config.metrics_port != 0) {
+        metrics_sock = create_metrics_socket(config.metrics_port);
+        info() << "Serving metrics on 127.0.0.1:" << config.metrics_port << "\n";
+    }
 
-    // Main server logic.
-    run_server(config, fds, client_map, clock, received_puts, file);
+    // Accept connections without blocking, so the whole queue can be drained.
+    if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0) {
+        fatal("Failed to set listening socket non-blocking.");
+    }
 
-    // Close open connections if any persist.
-    for (std::size_t i = 1; i < fds.size(); ++i) {
-        if (fds[i].fd != -1) {
-            disconnect_client(fds, i, client_map, received_puts);
+    if (config.shards > 1) {
+        run_sharded(config, clock, file, sock, metrics_sock);
+    } else {
+        // Setup the event loop.
+        // With io_uring connections are accepted by the kernel all the time, and
+        // parked while the game is full.
+        std::unique_ptr<EventLoop> loop = make_event_loop(config.backend);
+        ServerContext ctx{config, clock, *loop, file, sock};
+        ctx.output_cap = config.output_cap;
+        ctx.uring = dynamic_cast<UringLoop*>(loop.get());
+        if (ctx.uring) {
+            ctx.uring->accept(sock);
+        } else {
+            loop->add(sock, EVENT_READ);
         }
+        if (metrics_sock >= 0) {
+            loop->add(metrics_sock, EVENT_READ);
+        }
+        ctx.metrics_sock = metrics_sock;
+
+        // Record the session if requested.
+        std::unique_ptr<Recorder> recorder;
+        if (!config.record_file.empty()) {
+            recorder = std::make_unique<Recorder>(config.record_file,
+                                                  RecordingHeader{config.k, config.n, config.m});
+            ctx.recorder = recorder.get();
+            info() << "Recording to " << config.record_file << "\n";
+        }
+
+        // Main server logic.
+        run_server(ctx);
+
+        // Close open connections if any persist.
+        close_connections(ctx);
     }
 
-    file.close();
     close(sock);
+    if (metrics_sock >= 0) {
+        close(metrics_sock);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "async_log.h"
+
+#include <cerrno>
+
+namespace {
+    // Write the whole text to a descriptor, giving up on errors other than EINTR.
+    void write_all(int fd, std::string_view text) {
+        while (!text.empty()) {
+            ssize_t written = ::write(fd, text.data(), text.size());
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return;
+            }
+
+            text.remove_prefix(written);
+        }
+    }
+}   // namespace
+
+// Start the writer thread.
+AsyncLog::AsyncLog(std::size_t capacity) : capacity(capacity), writer(&AsyncLog::run, this) {}
+
+// Write all pending output and stop the writer.
+AsyncLog::~AsyncLog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    wakeup.notify_one();
+    writer.join();
+}
+
+// Queue text for STDOUT_FILENO or STDERR_FILENO.
+// Returns false if it was dropped.
+bool AsyncLog::write(int fd, std::string_view text) {
+    bool idle;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending_out.size() + pending_err.size() + text.size() > capacity) {
+            drops.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        idle = pending_out.empty() && pending_err.empty();
+        (fd == STDERR_FILENO ? pending_err : pending_out).append(text);
+    }
+
+    // The writer only sleeps with nothing pending.
+    if (idle) {
+        wakeup.notify_one();
+    }
+    return true;
+}
+
+// Number of dropped writes.
+uint64_t AsyncLog::dropped() const {
+    return drops.load(std::memory_order_relaxed);
+}
+
+// Take all pending output at once and write it outside the lock,
+// lines queued meanwhile are written in the next round.
+void AsyncLog::run() {
+    std::string out, err;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [this] { return stopping || !pending_out.empty() || !pending_err.empty(); });
+            if (pending_out.empty() && pending_err.empty()) {
+                return;
+            }
+
+            out.swap(pending_out);
+            err.swap(pending_err);
+        }
+
+        write_all(STDOUT_FILENO, out);
+        write_all(STDERR_FILENO, err);
+        out.clear();
+        err.clear();
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef APPROX_ASYNC_LOG_H
+#define APPROX_ASYNC_LOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+
+// Default limit of output awaiting a write.
+constexpr std::size_t LOG_CAPACITY = 64 << 20;
+
+// Output to stdout and stderr written by a background thread,
+// so event loops never block on a slow terminal or pipe.
+// Text that doesn't fit in the capacity is dropped.
+class AsyncLog {
+    public:
+        explicit AsyncLog(std::size_t capacity = LOG_CAPACITY);
+
+        // Write all pending output and stop the writer.
+        ~AsyncLog();
+
+        AsyncLog(AsyncLog const&) = delete;
+        AsyncLog& operator=(AsyncLog const&) = delete;
+
+        // Queue text for STDOUT_FILENO or STDERR_FILENO.
+        // Returns false if it was dropped.
+        bool write(int fd, std::string_view text);
+
+        // Number of dropped writes.
+        uint64_t dropped() const;
+
+    private:
+        // Writer thread loop.
+        void run();
+
+        std::size_t capacity;               // Limit of pending bytes.
+        std::mutex mutex;                   // Guards pending buffers and stopping.
+        std::condition_variable wakeup;     // Signalled on new output and stop.
+        std::string pending_out{};          // Text waiting for stdout.
+        std::string pending_err{};          // Text waiting for stderr.
+        bool stopping{};                    // Set by the destructor.
+        std::atomic<uint64_t> drops{0};     // Dropped writes.
+        std::thread writer;                 // Background writer, started last.
+};
+
+// Single line of log output, queued as a whole when destroyed.
+class LogLine {
+    public:
+        explicit LogLine(AsyncLog& log, int fd = STDOUT_FILENO) : log(log), fd(fd) {}
+
+        ~LogLine() {
+            log.write(fd, stream.view());
+        }
+
+        LogLine(LogLine const&) = delete;
+        LogLine& operator=(LogLine const&) = delete;
+
+        template <typename T>
+        LogLine& operator<<(T const& value) {
+            stream << value;
+            return *this;
+        }
+
+        // Stream manipulators like std::fixed.
+        LogLine& operator<<(std::ios_base& (*manipulator)(std::ios_base&)) {
+            stream << manipulator;
+            return *this;
+        }
+
+    private:
+        AsyncLog& log;
+        int fd;
+        std::ostringstream stream;
+};
+
+#endif // APPROX_ASYNC_LOG_H
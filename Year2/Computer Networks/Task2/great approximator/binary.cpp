@@ -0,0 +1,285 @@
+#include "binary.h"
+
+#include <bit>
+#include <cmath>
+
+namespace {
+    // Wire codes of message types.
+    constexpr uint8_t CODE_COEFF = 1;
+    constexpr uint8_t CODE_PUT = 2;
+    constexpr uint8_t CODE_BAD_PUT = 3;
+    constexpr uint8_t CODE_PENALTY = 4;
+    constexpr uint8_t CODE_STATE = 5;
+    constexpr uint8_t CODE_SCORING = 6;
+    constexpr uint8_t CODE_STATE_DELTA = 7;
+
+    // Sizes of payload fields.
+    constexpr std::size_t COUNT_SIZE = 2;
+    constexpr std::size_t POINT_SIZE = 2;
+    constexpr std::size_t VALUE_SIZE = 8;
+
+    uint8_t type_code(MessageType type) {
+        switch (type) {
+            case MessageType::COEFF:
+                return CODE_COEFF;
+            case MessageType::PUT:
+                return CODE_PUT;
+            case MessageType::BAD_PUT:
+                return CODE_BAD_PUT;
+            case MessageType::PENALTY:
+                return CODE_PENALTY;
+            case MessageType::STATE:
+                return CODE_STATE;
+            case MessageType::SCORING:
+                return CODE_SCORING;
+            case MessageType::STATE_DELTA:
+                return CODE_STATE_DELTA;
+            default:
+                return 0;
+        }
+    }
+
+    MessageType code_type(uint8_t code) {
+        switch (code) {
+            case CODE_COEFF:
+                return MessageType::COEFF;
+            case CODE_PUT:
+                return MessageType::PUT;
+            case CODE_BAD_PUT:
+                return MessageType::BAD_PUT;
+            case CODE_PENALTY:
+                return MessageType::PENALTY;
+            case CODE_STATE:
+                return MessageType::STATE;
+            case CODE_SCORING:
+                return MessageType::SCORING;
+            case CODE_STATE_DELTA:
+                return MessageType::STATE_DELTA;
+            default:
+                return MessageType::ERROR;
+        }
+    }
+
+    // Append a big endian unsigned integer of size bytes.
+    void put_uint(std::string& out, uint64_t value, std::size_t size) {
+        for (std::size_t i = size; i-- > 0;) {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    // Read a big endian unsigned integer of size bytes at pos and move pos past it.
+    uint64_t get_uint(std::string_view data, std::size_t& pos, std::size_t size) {
+        uint64_t value = 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            value = (value << 8) | static_cast<uint8_t>(data[pos++]);
+        }
+
+        return value;
+    }
+
+    // Append a fixed-point value, saturated at the range of i64.
+    void put_value(std::string& out, double value) {
+        constexpr double LIMIT = 0x1p63;    // First double above the range of i64.
+
+        double scaled = std::round(value * FIXED_SCALE);
+        int64_t fixed = 0;
+        if (scaled >= LIMIT) {
+            fixed = INT64_MAX;
+        } else if (scaled <= -LIMIT) {
+            fixed = INT64_MIN;
+        } else if (!std::isnan(scaled)) {
+            fixed = static_cast<int64_t>(scaled);
+        }
+
+        put_uint(out, static_cast<uint64_t>(fixed), VALUE_SIZE);
+    }
+
+    double get_value(std::string_view data, std::size_t& pos) {
+        return static_cast<double>(static_cast<int64_t>(get_uint(data, pos, VALUE_SIZE))) / FIXED_SCALE;
+    }
+
+    // Scores outgrow the fixed-point range, they are sent as IEEE 754 doubles.
+    void put_score(std::string& out, double score) {
+        put_uint(out, std::bit_cast<uint64_t>(score), VALUE_SIZE);
+    }
+
+    double get_score(std::string_view data, std::size_t& pos) {
+        return std::bit_cast<double>(get_uint(data, pos, VALUE_SIZE));
+    }
+
+    // Start a frame of given type and payload size.
+    std::string start_frame(MessageType type, std::size_t payload_size) {
+        std::string frame;
+        frame.reserve(FRAME_HEADER_SIZE + 1 + payload_size);
+        put_uint(frame, 1 + payload_size, FRAME_HEADER_SIZE);
+        frame.push_back(static_cast<char>(type_code(type)));
+        return frame;
+    }
+}
+
+// Extract the next complete frame from the buffer.
+std::optional<Frame> next_frame(LineBuffer& buffer, bool& malformed) {
+    std::string_view data = buffer.unread();
+    if (data.size() < FRAME_HEADER_SIZE) {
+        return std::nullopt;
+    }
+
+    std::size_t pos = 0;
+    std::size_t length = get_uint(data, pos, FRAME_HEADER_SIZE);
+    if (length == 0 || length > MAX_FRAME_SIZE) {
+        malformed = true;
+        return std::nullopt;
+    }
+
+    if (data.size() < FRAME_HEADER_SIZE + length) {
+        return std::nullopt;
+    }
+
+    buffer.consume(FRAME_HEADER_SIZE + length);
+    return Frame{code_type(static_cast<uint8_t>(data[pos])), data.substr(pos + 1, length - 1)};
+}
+
+// Decode a COEFF or STATE payload.
+std::optional<std::vector<double>> decode_values(std::string_view payload) {
+    if (payload.size() < COUNT_SIZE) {
+        return std::nullopt;
+    }
+
+    std::size_t pos = 0;
+    std::size_t count = get_uint(payload, pos, COUNT_SIZE);
+    if (count == 0 || payload.size() != COUNT_SIZE + count * VALUE_SIZE) {
+        return std::nullopt;
+    }
+
+    std::vector<double> values(count);
+    for (auto& value : values) {
+        value = get_value(payload, pos);
+    }
+
+    return values;
+}
+
+// Decode a PUT, BAD_PUT or PENALTY payload.
+std::optional<std::pair<int16_t, double>> decode_point_value(std::string_view payload) {
+    if (payload.size() != POINT_SIZE + VALUE_SIZE) {
+        return std::nullopt;
+    }
+
+    std::size_t pos = 0;
+    int16_t point = static_cast<int16_t>(get_uint(payload, pos, POINT_SIZE));
+    return std::make_pair(point, get_value(payload, pos));
+}
+
+// Decode a STATE_DELTA payload.
+std::optional<std::vector<std::pair<int16_t, double>>> decode_point_values(std::string_view payload) {
+    if (payload.size() < COUNT_SIZE) {
+        return std::nullopt;
+    }
+
+    std::size_t pos = 0;
+    std::size_t count = get_uint(payload, pos, COUNT_SIZE);
+    if (count == 0 || payload.size() != COUNT_SIZE + count * (POINT_SIZE + VALUE_SIZE)) {
+        return std::nullopt;
+    }
+
+    std::vector<std::pair<int16_t, double>> changes(count);
+    for (auto& [point, value] : changes) {
+        point = static_cast<int16_t>(get_uint(payload, pos, POINT_SIZE));
+        value = get_value(payload, pos);
+    }
+
+    return changes;
+}
+
+// Decode a SCORING payload.
+std::optional<std::vector<std::pair<std::string, double>>> decode_scoring(std::string_view payload) {
+    if (payload.size() < COUNT_SIZE) {
+        return std::nullopt;
+    }
+
+    std::size_t pos = 0;
+    std::size_t count = get_uint(payload, pos, COUNT_SIZE);
+
+    std::vector<std::pair<std::string, double>> scoring;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (pos >= payload.size()) {
+            return std::nullopt;
+        }
+
+        std::size_t length = get_uint(payload, pos, 1);
+        if (payload.size() - pos < length + VALUE_SIZE) {
+            return std::nullopt;
+        }
+
+        std::string player_id(payload.substr(pos, length));
+        pos += length;
+        scoring.emplace_back(std::move(player_id), get_score(payload, pos));
+    }
+
+    if (pos != payload.size()) {
+        return std::nullopt;
+    }
+
+    return scoring;
+}
+
+// Build a COEFF or STATE frame.
+std::string encode_values(MessageType type, std::vector<double> const& values) {
+    std::string frame = start_frame(type, COUNT_SIZE + values.size() * VALUE_SIZE);
+    put_uint(frame, values.size(), COUNT_SIZE);
+    for (double value : values) {
+        put_value(frame, value);
+    }
+
+    return frame;
+}
+
+// Build a PUT, BAD_PUT or PENALTY frame.
+std::string encode_point_value(MessageType type, int16_t point, double value) {
+    std::string frame = start_frame(type, POINT_SIZE + VALUE_SIZE);
+    put_uint(frame, static_cast<uint16_t>(point), POINT_SIZE);
+    put_value(frame, value);
+    return frame;
+}
+
+// Build a STATE_DELTA frame.
+std::string encode_point_values(MessageType type, std::vector<std::pair<int16_t, double>> const& changes) {
+    std::string frame = start_frame(type, COUNT_SIZE + changes.size() * (POINT_SIZE + VALUE_SIZE));
+    put_uint(frame, changes.size(), COUNT_SIZE);
+    for (auto const& [point, value] : changes) {
+        put_uint(frame, static_cast<uint16_t>(point), POINT_SIZE);
+        put_value(frame, value);
+    }
+
+    return frame;
+}
+
+// Build a request for a full STATE.
+std::string encode_state_request() {
+    return start_frame(MessageType::STATE, 0);
+}
+
+// Build a SCORING frame, player ids are at most 255 bytes long.
+std::string encode_scoring(std::vector<std::pair<std::string, double>> const& scoring) {
+    std::size_t size = COUNT_SIZE;
+    for (auto const& [player_id, score] : scoring) {
+        size += 1 + std::min<std::size_t>(player_id.size(), 255) + VALUE_SIZE;
+    }
+
+    std::string frame = start_frame(MessageType::SCORING, size);
+    put_uint(frame, scoring.size(), COUNT_SIZE);
+    for (auto const& [player_id, score] : scoring) {
+        std::size_t length = std::min<std::size_t>(player_id.size(), 255);
+        put_uint(frame, length, 1);
+        frame.append(player_id, 0, length);
+        put_score(frame, score);
+    }
+
+    return frame;
+}
+
+// Short description of a frame, for error messages.
+std::string describe_frame(Frame const& frame) {
+    return "<binary frame type " + std::to_string(static_cast<int>(frame.type)) + ", "
+         + std::to_string(frame.payload.size()) + " bytes>";
+}
@@ -0,0 +1,62 @@
+#ifndef APPROX_BINARY_H
+#define APPROX_BINARY_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "protocol.h"
+#include "buffer.h"
+
+// Binary framing of the protocol, requested by the client with "HELLO <player_id> BINARY".
+// All following messages in both directions are frames:
+//   u32 length of the rest of the frame, u8 message type, payload.
+// Integers are big endian. Values are fixed-point: i64 in units of 1e-7,
+// the precision of the text protocol, saturated at its range. Scores are
+// IEEE 754 doubles, as they grow far beyond that range. Payloads by type:
+//   COEFF, STATE:            u16 count, count values
+//   PUT, BAD_PUT, PENALTY:   i16 point, value
+//   STATE_DELTA:             u16 count, count times (i16 point, value)
+//   SCORING:                 u16 count, count times (u8 length, player id, score)
+// A STATE frame with an empty payload is a client's request for a full STATE.
+
+// Scale of fixed-point values.
+constexpr double FIXED_SCALE = 1e7;
+
+// Length of the frame length field.
+constexpr std::size_t FRAME_HEADER_SIZE = 4;
+
+// Largest accepted frame, more than a STATE for the maximal K.
+constexpr std::size_t MAX_FRAME_SIZE = 1 << 20;
+
+// Single received frame.
+struct Frame {
+    MessageType type;           // Message type, ERROR for unknown ones.
+    std::string_view payload;   // Payload, valid until the buffer is written to.
+};
+
+// Extract the next complete frame from the buffer.
+// std::nullopt if no complete frame is buffered. malformed is set
+// if the buffered data can't be a frame, the session should end then.
+std::optional<Frame> next_frame(LineBuffer& buffer, bool& malformed);
+
+// Decode payloads, std::nullopt if the payload doesn't match the type layout.
+std::optional<std::vector<double>> decode_values(std::string_view payload);
+std::optional<std::pair<int16_t, double>> decode_point_value(std::string_view payload);
+std::optional<std::vector<std::pair<int16_t, double>>> decode_point_values(std::string_view payload);
+std::optional<std::vector<std::pair<std::string, double>>> decode_scoring(std::string_view payload);
+
+// Build frames for sending.
+std::string encode_values(MessageType type, std::vector<double> const& values);
+std::string encode_point_value(MessageType type, int16_t point, double value);
+std::string encode_point_values(MessageType type, std::vector<std::pair<int16_t, double>> const& changes);
+std::string encode_state_request();
+std::string encode_scoring(std::vector<std::pair<std::string, double>> const& scoring);
+
+// Short description of a frame, for error messages.
+std::string describe_frame(Frame const& frame);
+
+#endif // APPROX_BINARY_H
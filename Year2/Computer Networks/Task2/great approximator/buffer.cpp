@@ -0,0 +1,154 @@
+#include "buffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "protocol.h"
+
+// Maximum number of segments passed to a single sendmsg call.
+constexpr std::size_t MAX_SEGMENTS = 64;
+
+LineBuffer::LineBuffer() : LineBuffer(LINE_BUFFER_CAPACITY) {}
+
+LineBuffer::LineBuffer(std::size_t capacity) : data(capacity) {}
+
+// Get contiguous free space of at least min_size bytes to receive into.
+char* LineBuffer::write_area(std::size_t min_size) {
+    if (data.size() - tail < min_size) {
+        // Move the unread tail to the front.
+        if (head > 0) {
+            std::memmove(data.data(), data.data() + head, tail - head);
+            tail -= head;
+            scanned -= head;
+            head = 0;
+        }
+
+        // A single unfinished line fills the whole buffer.
+        if (data.size() - tail < min_size) {
+            data.resize(std::max(data.size() * 2, tail + min_size));
+        }
+    }
+
+    return data.data() + tail;
+}
+
+// Mark size bytes written to the write area as received.
+void LineBuffer::commit(std::size_t size) {
+    tail += size;
+}
+
+// Copy data to the end of the buffer.
+void LineBuffer::append(std::string_view str) {
+    std::memcpy(write_area(str.size()), str.data(), str.size());
+    commit(str.size());
+}
+
+// Extract the next complete line, without the delimiter.
+std::optional<std::string_view> LineBuffer::next_line() {
+    std::string_view unread(data.data() + head, tail - head);
+    std::size_t pos = unread.find(DELIMITER, scanned - head);
+
+    if (pos == std::string_view::npos) {
+        // The last byte may be the first half of a delimiter.
+        scanned = std::max(head, tail - std::min<std::size_t>(tail, 1));
+        return std::nullopt;
+    }
+
+    head += pos + 2;
+    scanned = head;
+    return unread.substr(0, pos);
+}
+
+// Buffered bytes not yet handed out.
+std::string_view LineBuffer::unread() const {
+    return std::string_view(data.data() + head, tail - head);
+}
+
+// Hand out size bytes of unread data.
+void LineBuffer::consume(std::size_t size) {
+    head += size;
+    scanned = std::max(scanned, head);
+}
+
+// Number of buffered bytes not yet handed out.
+std::size_t LineBuffer::size() const {
+    return tail - head;
+}
+
+bool LineBuffer::empty() const {
+    return head == tail;
+}
+
+// Queue a message for sending.
+void OutputQueue::push(std::string message) {
+    if (message.empty()) {
+        return;
+    }
+
+    bytes += message.size();
+    segments.push_back(std::move(message));
+}
+
+// Send as much as the socket accepts, dropping sent data from the queue.
+ssize_t OutputQueue::send(int fd, int flags) {
+    iovec iov[MAX_SEGMENTS];
+    std::size_t count = std::min(segments.size(), MAX_SEGMENTS);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t skip = i == 0 ? offset : 0;
+        iov[i].iov_base = segments[i].data() + skip;
+        iov[i].iov_len = segments[i].size() - skip;
+    }
+
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    ssize_t sent = sendmsg(fd, &msg, flags);
+    if (sent <= 0) {
+        return sent;
+    }
+
+    // Drop fully sent segments and remember the offset in a partially sent one.
+    bytes -= sent;
+    std::size_t left = sent;
+    while (left > 0) {
+        std::size_t remaining = segments.front().size() - offset;
+        if (left < remaining) {
+            offset += left;
+            break;
+        }
+
+        left -= remaining;
+        offset = 0;
+        segments.pop_front();
+    }
+
+    return sent;
+}
+
+// Remove and return all queued messages, for senders that own the data in flight.
+std::vector<std::string> OutputQueue::take() {
+    std::vector<std::string> messages(std::make_move_iterator(segments.begin()),
+                                      std::make_move_iterator(segments.end()));
+    if (!messages.empty()) {
+        messages.front().erase(0, offset);
+    }
+
+    segments.clear();
+    offset = 0;
+    bytes = 0;
+    return messages;
+}
+
+// Number of pending bytes.
+std::size_t OutputQueue::size() const {
+    return bytes;
+}
+
+bool OutputQueue::empty() const {
+    return bytes == 0;
+}
\ No newline at end of file
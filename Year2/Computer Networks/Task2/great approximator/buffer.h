@@ -0,0 +1,81 @@
+#ifndef APPROX_BUFFER_H
+#define APPROX_BUFFER_H
+
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+
+// Default initial capacity of a LineBuffer.
+constexpr std::size_t LINE_BUFFER_CAPACITY = 4096;
+
+// Input buffer handing out complete lines as views into its own storage.
+// Data is received straight into the buffer and consumed lines are only skipped,
+// the unread tail is moved to the front when there is no room left behind it.
+// The capacity is fixed, unless a single unfinished line doesn't fit in it.
+class LineBuffer {
+    public:
+        LineBuffer();
+        explicit LineBuffer(std::size_t capacity);
+
+        // Get contiguous free space of at least min_size bytes to receive into.
+        // Invalidates previously returned lines.
+        char* write_area(std::size_t min_size);
+
+        // Mark size bytes written to the write area as received.
+        void commit(std::size_t size);
+
+        // Copy data to the end of the buffer.
+        void append(std::string_view data);
+
+        // Extract the next complete line, without the delimiter.
+        // std::nullopt if no complete line is buffered.
+        // The view is valid until the next write_area or append call.
+        std::optional<std::string_view> next_line();
+
+        // Buffered bytes not yet handed out, for framings other than lines.
+        // The view is valid until the next write_area or append call.
+        std::string_view unread() const;
+
+        // Hand out size bytes of unread data.
+        void consume(std::size_t size);
+
+        // Number of buffered bytes not yet handed out.
+        std::size_t size() const;
+        bool empty() const;
+
+    private:
+        std::vector<char> data;     // Storage.
+        std::size_t head = 0;       // Start of unread data.
+        std::size_t tail = 0;       // End of received data.
+        std::size_t scanned = 0;    // Unread data before this position contains no delimiter.
+};
+
+// Output queue of whole messages, sent with a single scatter/gather call
+// over the queued segments, so neither queueing nor sending moves pending data.
+class OutputQueue {
+    public:
+        // Queue a message for sending.
+        void push(std::string message);
+
+        // Send as much as the socket accepts, dropping sent data from the queue.
+        // Returns the result of sendmsg, errno is preserved on failure.
+        ssize_t send(int fd, int flags);
+
+        // Remove and return all queued messages, for senders that own the data in flight.
+        std::vector<std::string> take();
+
+        // Number of pending bytes.
+        std::size_t size() const;
+        bool empty() const;
+
+    private:
+        std::deque<std::string> segments;   // Queued messages.
+        std::size_t offset = 0;             // Bytes of the first segment already sent.
+        std::size_t bytes = 0;              // Total pending bytes.
+};
+
+#endif // APPROX_BUFFER_H
\ No newline at end of file
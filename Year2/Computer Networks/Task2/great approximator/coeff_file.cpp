@@ -0,0 +1,93 @@
+#include "coeff_file.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "err.h"
+
+// Map and index the file, exits the program on failure.
+CoeffFile::CoeffFile(std::string const& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fatal("Failed to open file.");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fatal("Failed to stat file.");
+    }
+    length = static_cast<std::size_t>(st.st_size);
+
+    // Empty files can't be mapped, they simply have no lines.
+    if (length > 0) {
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            fatal("Failed to map file.");
+        }
+        data = static_cast<char*>(mapped);
+        madvise(data, length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    // Index lines, a last line without '\n' counts as well.
+    std::size_t pos = 0;
+    while (pos < length) {
+        line_starts.push_back(pos);
+        char const* end = static_cast<char const*>(std::memchr(data + pos, '\n', length - pos));
+        pos = end ? end - data + 1 : length;
+    }
+    line_starts.push_back(length);
+
+    // Parse coefficients of each line without its "\r\n".
+    coeff_starts.reserve(line_starts.size());
+    for (std::size_t i = 0; i < size(); ++i) {
+        std::string_view text = line(i);
+        if (text.ends_with('\r')) {
+            text.remove_suffix(1);
+        }
+
+        coeff_starts.push_back(arena.size());
+        std::vector<double> parsed = parse_coeff(text);
+        arena.insert(arena.end(), parsed.begin(), parsed.end());
+    }
+    coeff_starts.push_back(arena.size());
+}
+
+// Unmap the file.
+CoeffFile::~CoeffFile() {
+    if (data) {
+        munmap(data, length);
+    }
+}
+
+// Number of lines.
+std::size_t CoeffFile::size() const {
+    return line_starts.size() - 1;
+}
+
+// Line i without its '\n', empty past the end of the file.
+std::string_view CoeffFile::line(std::size_t i) const {
+    if (i >= size()) {
+        return {};
+    }
+
+    std::string_view text(data + line_starts[i], line_starts[i + 1] - line_starts[i]);
+    if (text.ends_with('\n')) {
+        text.remove_suffix(1);
+    }
+
+    return text;
+}
+
+// Coefficients parsed from line i, empty past the end of the file.
+std::span<double const> CoeffFile::coeffs(std::size_t i) const {
+    if (i >= size()) {
+        return {};
+    }
+
+    return std::span<double const>(arena).subspan(coeff_starts[i], coeff_starts[i + 1] - coeff_starts[i]);
+}
@@ -0,0 +1,39 @@
+#ifndef APPROX_COEFF_FILE_H
+#define APPROX_COEFF_FILE_H
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// File with one COEFF message per line, mapped into memory and indexed at startup.
+// Coefficients of all lines are parsed once into a single arena. The object is
+// immutable afterwards, so concurrent games share it, each with its own cursor.
+class CoeffFile {
+    public:
+        // Map and index the file, exits the program on failure.
+        explicit CoeffFile(std::string const& path);
+        ~CoeffFile();
+
+        CoeffFile(CoeffFile const&) = delete;
+        CoeffFile& operator=(CoeffFile const&) = delete;
+
+        // Number of lines.
+        std::size_t size() const;
+
+        // Line i without its '\n', empty past the end of the file.
+        std::string_view line(std::size_t i) const;
+
+        // Coefficients parsed from line i, empty past the end of the file.
+        std::span<double const> coeffs(std::size_t i) const;
+
+    private:
+        char* data{};                               // Mapped file, nullptr if empty.
+        std::size_t length{};                       // File size.
+        std::vector<std::size_t> line_starts{};     // Offset of each line, then the file size.
+        std::vector<double> arena{};                // Coefficients of all lines.
+        std::vector<std::size_t> coeff_starts{};    // Arena index of each line, then the arena size.
+};
+
+#endif // APPROX_COEFF_FILE_H
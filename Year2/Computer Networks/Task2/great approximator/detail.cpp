@@ -11,6 +11,9 @@
 #include <fcntl.h>
 #include <algorithm>
 #include <cctype>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "err.h"
 
@@ -86,11 +89,21 @@ namespace detail {
 
     // Method definition to get elapsed time in milliseconds
     int64_t Clock::get_time() const {
+        if (manual) {
+            return manual_time;
+        }
+
         auto now = std::chrono::steady_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
         return duration.count();
     }
 
+    // Stop following real time and report the given time, for replays.
+    void Clock::set_time(int64_t time) {
+        manual = true;
+        manual_time = time;
+    }
+
     // Check if a player ID is valid.
     bool is_valid_player_id(std::string const& id) {
         static const std::regex pattern("^[A-Za-z0-9]+$");
@@ -134,6 +147,90 @@ namespace detail {
         return result;
     }
 
+#if defined(__x86_64__) || defined(__i386__)
+    // Evaluate a polynomial at 4 consecutive points per step.
+    // Each lane performs exactly the operations of poly_val, in the same order,
+    // and multiplications are never contracted with additions into FMA,
+    // so results are bit-identical.
+    // Returns the number of evaluated points, the rest is left to the caller.
+    __attribute__((target("avx2"), optimize("fp-contract=off")))
+    static std::size_t poly_vals_avx2(std::vector<double> const& coeffs, int first,
+                                      std::size_t count, double* out) {
+        __m256d const offsets = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+        std::size_t i = 0;
+
+        for (; i + 4 <= count; i += 4) {
+            __m256d x = _mm256_add_pd(_mm256_set1_pd(static_cast<double>(first + static_cast<int>(i))), offsets);
+            __m256d result = _mm256_setzero_pd();
+            __m256d pow = _mm256_set1_pd(1.0);
+
+            for (double coeff : coeffs) {
+                result = _mm256_add_pd(result, _mm256_mul_pd(_mm256_set1_pd(coeff), pow));
+                pow = _mm256_mul_pd(pow, x);
+            }
+
+            _mm256_storeu_pd(out + i, result);
+        }
+
+        return i;
+    }
+
+    // Same as poly_vals_avx2 with 8 points per step.
+    __attribute__((target("avx512f"), optimize("fp-contract=off")))
+    static std::size_t poly_vals_avx512(std::vector<double> const& coeffs, int first,
+                                        std::size_t count, double* out) {
+        __m512d const offsets = _mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0);
+        std::size_t i = 0;
+
+        for (; i + 8 <= count; i += 8) {
+            __m512d x = _mm512_add_pd(_mm512_set1_pd(static_cast<double>(first + static_cast<int>(i))), offsets);
+            __m512d result = _mm512_setzero_pd();
+            __m512d pow = _mm512_set1_pd(1.0);
+
+            for (double coeff : coeffs) {
+                result = _mm512_add_pd(result, _mm512_mul_pd(_mm512_set1_pd(coeff), pow));
+                pow = _mm512_mul_pd(pow, x);
+            }
+
+            _mm512_storeu_pd(out + i, result);
+        }
+
+        return i;
+    }
+#endif
+
+    // Evaluate a polynomial at points first, first + 1, ..., first + count - 1.
+    // Uses the widest vector unit available at runtime, the remaining points
+    // are evaluated one by one.
+    std::vector<double> poly_vals(std::vector<double> const& coeffs, int first, std::size_t count,
+                                  PolyPath path) {
+        std::vector<double> values(count);
+        std::size_t done = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+        static bool const has_avx512 = __builtin_cpu_supports("avx512f");
+        static bool const has_avx2 = __builtin_cpu_supports("avx2");
+
+        if (path == PolyPath::AUTO) {
+            path = has_avx512 ? PolyPath::AVX512 : has_avx2 ? PolyPath::AVX2 : PolyPath::SCALAR;
+        }
+
+        if (path == PolyPath::AVX512 && has_avx512) {
+            done = poly_vals_avx512(coeffs, first, count, values.data());
+        } else if (path == PolyPath::AVX2 && has_avx2) {
+            done = poly_vals_avx2(coeffs, first, count, values.data());
+        }
+#else
+        (void) path;
+#endif
+
+        for (std::size_t i = done; i < count; ++i) {
+            values[i] = poly_val(coeffs, first + static_cast<int>(i));
+        }
+
+        return values;
+    }
+
     // Create and bind a socket to the specified port (host order).
     // Defaults to dual-stack, if IPv6 fails, it falls back to IPv4.
     // If port is 0, bind to OS assigned port.
@@ -25,9 +25,12 @@ namespace detail {
         public:
             Clock();                // Constructor.
             int64_t get_time() const;   // Get the elapsed time in milliseconds.
+            void set_time(int64_t time);    // Stop following real time and report the given time, for replays.
         
         private:
             std::chrono::steady_clock::time_point start_time;
+            bool manual = false;        // Whether the time is set by hand.
+            int64_t manual_time = 0;    // Time reported when set by hand.
     };
 
     // Check if a player ID is valid.
@@ -39,6 +42,20 @@ namespace detail {
     // Evaluate a polynomial at a given point x.
     double poly_val(std::vector<double> const& coeffs, int x);
 
+    // Implementations of poly_vals, AUTO picks the widest one the CPU supports.
+    // Unsupported ones fall back to SCALAR.
+    enum class PolyPath {
+        AUTO,
+        SCALAR,
+        AVX2,
+        AVX512
+    };
+
+    // Evaluate a polynomial at points first, first + 1, ..., first + count - 1.
+    // Results are bit-identical to poly_val at each point.
+    std::vector<double> poly_vals(std::vector<double> const& coeffs, int first, std::size_t count,
+                                  PolyPath path = PolyPath::AUTO);
+
     // Create and bind a socket to the specified port.
     // Defaults to dual-stack, if IPv6 fails, it falls back to IPv4.
     // If port is 0, bind to OS assigned port.
@@ -4,7 +4,17 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
+namespace err_util {
+    namespace {
+        void write_to_cerr(std::string const& text) {
+            std::cerr << text;
+        }
+    }   // namespace
+
+    void (*write_error)(std::string const& text) = write_to_cerr;
+}   // namespace err_util
+
 // Print an error message related to message processing.
-void msg_error(std::string const& ip_str, uint16_t port, std::string const& message, std::string const& player_id) {
+void msg_error(std::string const& ip_str, uint16_t port, std::string_view message, std::string const& player_id) {
     err("bad message from [", ip_str, "]:", port, ", ", player_id, ": ", message);
 }
\ No newline at end of file
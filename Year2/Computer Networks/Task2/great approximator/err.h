@@ -2,6 +2,7 @@
 #define APPROX_ERR_H
 
 #include <string>
+#include <string_view>
 #include <cerrno>
 #include <iostream>
 #include <sstream>
@@ -16,13 +17,16 @@ namespace err_util{
         (oss << ... << std::forward<Args>(args));
         return oss.str();
     }
+
+    // Destination of error messages, std::cerr unless replaced by the program.
+    extern void (*write_error)(std::string const& text);
 } // namespace err_util
 
 // Print an error message.
 // This function is used to print error messages that are not related to system calls.
 template <typename... Args>
 void err(Args&&... args) {
-    std::cerr << "ERROR: " << err_util::to_string(std::forward<Args>(args)...) << "\n";
+    err_util::write_error("ERROR: " + err_util::to_string(std::forward<Args>(args)...) + "\n");
 }
 
 // Print an error message and exit the program.
@@ -38,11 +42,11 @@ template <typename... Args>
 template <typename... Args>
 void syserr(Args&&... args) {
     int org_errno = errno;
-    std::cerr << "ERROR: " << err_util::to_string(std::forward<Args>(args)...)
-              << " (" << org_errno << "; " << std::strerror(org_errno) << ")\n";
+    err_util::write_error("ERROR: " + err_util::to_string(std::forward<Args>(args)...,
+                                                          " (", org_errno, "; ", std::strerror(org_errno), ")\n"));
 }
 
 // Print an error message related to message processing.
-void msg_error(std::string const& ip_str, uint16_t port, std::string const& message, std::string const& player_id);
+void msg_error(std::string const& ip_str, uint16_t port, std::string_view message, std::string const& player_id);
 
 #endif // APPROX_ERR_H
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include "event_loop.h"
+
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "err.h"
+#include "uring_loop.h"
+
+// Maximum number of events returned by a single epoll_wait.
+constexpr std::size_t MAX_EPOLL_EVENTS = 256;
+
+// Convert interest flags to poll events.
+static short to_poll_events(uint32_t interest) {
+    short events = 0;
+    if (interest & EVENT_READ) {
+        events |= POLLIN;
+    }
+    if (interest & EVENT_WRITE) {
+        events |= POLLOUT;
+    }
+
+    return events;
+}
+
+// Convert interest flags to edge-triggered epoll events.
+// Write interest is always kept, as an edge is reported only once anyway.
+static uint32_t to_epoll_events(uint32_t interest) {
+    uint32_t events = EPOLLET | EPOLLOUT;
+    if (interest & EVENT_READ) {
+        events |= EPOLLIN;
+    }
+
+    return events;
+}
+
+// Start watching a descriptor with given interest.
+void PollLoop::add(int fd, uint32_t interest) {
+    if (static_cast<std::size_t>(fd) >= slots.size()) {
+        slots.resize(fd + 1, -1);
+    }
+
+    slots[fd] = fds.size();
+    fds.push_back({fd, to_poll_events(interest), 0});
+}
+
+// Change the interest of a watched descriptor.
+void PollLoop::modify(int fd, uint32_t interest) {
+    fds[slots[fd]].events = to_poll_events(interest);
+}
+
+// Stop watching a descriptor.
+// Moves the last pollfd into the freed slot, so the array stays dense.
+void PollLoop::remove(int fd) {
+    int slot = slots[fd];
+    if (slot < 0) {
+        return;
+    }
+
+    fds[slot] = fds.back();
+    slots[fds[slot].fd] = slot;
+    fds.pop_back();
+    slots[fd] = -1;
+}
+
+// Wait for events and collect ready descriptors.
+bool PollLoop::wait(int64_t timeout, std::vector<Event>& events) {
+    events.clear();
+
+    int poll_result = poll(fds.data(), fds.size(), timeout);
+    if (poll_result < 0) {
+        if (errno == EINTR) {
+            return false;
+        }
+        fatal("Poll failed.");
+    }
+
+    for (std::size_t i = 0; i < fds.size() && events.size() < static_cast<std::size_t>(poll_result); ++i) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+
+        uint32_t flags = 0;
+        if (fds[i].revents & POLLIN) {
+            flags |= EVENT_READ;
+        }
+        if (fds[i].revents & POLLOUT) {
+            flags |= EVENT_WRITE;
+        }
+        if (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+            flags |= EVENT_ERROR;
+        }
+
+        events.push_back({fds[i].fd, flags});
+    }
+
+    return true;
+}
+
+// Name of the backend.
+char const* PollLoop::name() const {
+    return "poll";
+}
+
+// Create the epoll instance.
+EpollLoop::EpollLoop() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)) {}
+
+// Close the epoll instance.
+EpollLoop::~EpollLoop() {
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+// Start watching a descriptor with given interest.
+void EpollLoop::add(int fd, uint32_t flags) {
+    epoll_event event{};
+    event.events = to_epoll_events(flags);
+    event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        fatal("epoll_ctl(ADD) failed.");
+    }
+
+    if (static_cast<std::size_t>(fd) >= interest.size()) {
+        interest.resize(fd + 1, 0);
+    }
+    interest[fd] = event.events;
+}
+
+// Change the interest of a watched descriptor.
+// Skips the system call if the registered events would not change.
+void EpollLoop::modify(int fd, uint32_t flags) {
+    epoll_event event{};
+    event.events = to_epoll_events(flags);
+    event.data.fd = fd;
+
+    if (interest[fd] == event.events) {
+        return;
+    }
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+        fatal("epoll_ctl(MOD) failed.");
+    }
+    interest[fd] = event.events;
+}
+
+// Stop watching a descriptor.
+void EpollLoop::remove(int fd) {
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr) < 0) {
+        syserr("epoll_ctl(DEL) failed");
+    }
+    interest[fd] = 0;
+}
+
+// Wait for events and collect ready descriptors.
+bool EpollLoop::wait(int64_t timeout, std::vector<Event>& events) {
+    epoll_event ready[MAX_EPOLL_EVENTS];
+    events.clear();
+
+    int count = epoll_wait(epoll_fd, ready, MAX_EPOLL_EVENTS, timeout);
+    if (count < 0) {
+        if (errno == EINTR) {
+            return false;
+        }
+        fatal("epoll_wait failed.");
+    }
+
+    for (int i = 0; i < count; ++i) {
+        uint32_t flags = 0;
+        if (ready[i].events & EPOLLIN) {
+            flags |= EVENT_READ;
+        }
+        if (ready[i].events & EPOLLOUT) {
+            flags |= EVENT_WRITE;
+        }
+        if (ready[i].events & (EPOLLHUP | EPOLLERR)) {
+            flags |= EVENT_ERROR;
+        }
+
+        events.push_back({ready[i].data.fd, flags});
+    }
+
+    return true;
+}
+
+// Name of the backend.
+char const* EpollLoop::name() const {
+    return "epoll";
+}
+
+// Whether epoll instance was created successfully.
+bool EpollLoop::is_valid() const {
+    return epoll_fd >= 0;
+}
+
+// Parse backend name from a string.
+Backend parse_backend(std::string const& str) {
+    if (str == "poll") {
+        return Backend::POLL;
+    } else if (str == "epoll") {
+        return Backend::EPOLL;
+    } else if (str == "uring") {
+        return Backend::URING;
+    } else {
+        fatal("Unknown event loop backend: ", str);
+    }
+}
+
+// Create an event loop with the given backend.
+// Falls back to epoll if io_uring is unavailable, and to poll if epoll is.
+std::unique_ptr<EventLoop> make_event_loop(Backend backend) {
+    if (backend == Backend::URING) {
+        auto loop = UringLoop::create();
+        if (loop) {
+            return loop;
+        }
+
+        syserr("io_uring setup failed, falling back to epoll");
+        backend = Backend::EPOLL;
+    }
+
+    if (backend == Backend::EPOLL) {
+        auto loop = std::make_unique<EpollLoop>();
+        if (loop->is_valid()) {
+            return loop;
+        }
+
+        syserr("epoll_create1 failed, falling back to poll");
+    }
+
+    return std::make_unique<PollLoop>();
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#ifndef APPROX_EVENT_LOOP_H
+#define APPROX_EVENT_LOOP_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <poll.h>
+
+// Interest and readiness flags, independent of the backend.
+constexpr uint32_t EVENT_READ = 1 << 0;
+constexpr uint32_t EVENT_WRITE = 1 << 1;
+constexpr uint32_t EVENT_ERROR = 1 << 2;
+
+// Available event loop backends.
+enum class Backend {
+    POLL,
+    EPOLL,
+    URING
+};
+
+// Single readiness notification.
+struct Event {
+    int fd;             // Ready file descriptor.
+    uint32_t flags;     // Combination of EVENT_* flags.
+};
+
+// Readiness notification interface shared by all backends.
+// Backends may be edge-triggered, so users should drain sockets
+// until EAGAIN and always try to send right after queueing data.
+class EventLoop {
+    public:
+        virtual ~EventLoop() = default;
+
+        // Start watching a descriptor with given interest.
+        virtual void add(int fd, uint32_t interest) = 0;
+
+        // Change the interest of a watched descriptor.
+        virtual void modify(int fd, uint32_t interest) = 0;
+
+        // Stop watching a descriptor, must be called before closing it.
+        virtual void remove(int fd) = 0;
+
+        // Wait at most timeout milliseconds (-1 for infinity) and fill events
+        // with ready descriptors only. Returns false if interrupted.
+        virtual bool wait(int64_t timeout, std::vector<Event>& events) = 0;
+
+        // Name of the backend, for printing.
+        virtual char const* name() const = 0;
+};
+
+// Level-triggered backend based on poll().
+// Keeps the pollfd array dense, so there are no holes to skip.
+class PollLoop : public EventLoop {
+    public:
+        void add(int fd, uint32_t interest) override;
+        void modify(int fd, uint32_t interest) override;
+        void remove(int fd) override;
+        bool wait(int64_t timeout, std::vector<Event>& events) override;
+        char const* name() const override;
+
+    private:
+        std::vector<pollfd> fds;        // Watched descriptors.
+        std::vector<int> slots;         // Index in fds for each descriptor, -1 if not watched.
+};
+
+// Edge-triggered backend based on epoll.
+// Only ready descriptors are touched on each wakeup.
+class EpollLoop : public EventLoop {
+    public:
+        EpollLoop();
+        ~EpollLoop() override;
+
+        void add(int fd, uint32_t interest) override;
+        void modify(int fd, uint32_t interest) override;
+        void remove(int fd) override;
+        bool wait(int64_t timeout, std::vector<Event>& events) override;
+        char const* name() const override;
+
+        // Whether epoll instance was created successfully.
+        bool is_valid() const;
+
+    private:
+        int epoll_fd;                   // Epoll instance.
+        std::vector<uint32_t> interest; // Registered epoll events for each descriptor.
+};
+
+// Parse backend name from a string.
+Backend parse_backend(std::string const& str);
+
+// Create an event loop with the given backend.
+// Falls back to epoll if io_uring is unavailable, and to poll if epoll is.
+std::unique_ptr<EventLoop> make_event_loop(Backend backend);
+
+#endif // APPROX_EVENT_LOOP_H
\ No newline at end of file
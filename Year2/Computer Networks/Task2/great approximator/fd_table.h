@@ -0,0 +1,79 @@
+#ifndef APPROX_FD_TABLE_H
+#define APPROX_FD_TABLE_H
+
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Table of values keyed by file descriptor.
+// Descriptors are small and reused lowest first, so values are kept in
+// a slab indexed directly by descriptor: lookups are a single array access
+// and never insert by accident. Inserting may move the values, so references
+// are only stable between inserts.
+template <typename T>
+class FdTable {
+    public:
+        // Insert a value for a descriptor that is not present.
+        T& insert(int fd, T value) {
+            if (static_cast<std::size_t>(fd) >= slots.size()) {
+                slots.resize(fd + 1);
+            }
+
+            ++count;
+            return slots[fd].emplace(std::move(value));
+        }
+
+        // Value for a descriptor, nullptr if not present.
+        T* find(int fd) {
+            if (fd < 0 || static_cast<std::size_t>(fd) >= slots.size() || !slots[fd].has_value()) {
+                return nullptr;
+            }
+
+            return &slots[fd].value();
+        }
+
+        // Remove the value of a present descriptor.
+        void erase(int fd) {
+            slots[fd].reset();
+            --count;
+        }
+
+        // Present descriptors in increasing order.
+        // Used to iterate while values are being erased.
+        std::vector<int> keys() const {
+            std::vector<int> result;
+            result.reserve(count);
+            for (std::size_t fd = 0; fd < slots.size(); ++fd) {
+                if (slots[fd].has_value()) {
+                    result.push_back(static_cast<int>(fd));
+                }
+            }
+
+            return result;
+        }
+
+        // Call f on every value in increasing descriptor order.
+        template <typename F>
+        void for_each(F&& f) {
+            for (auto& slot : slots) {
+                if (slot.has_value()) {
+                    f(slot.value());
+                }
+            }
+        }
+
+        std::size_t size() const {
+            return count;
+        }
+
+        bool empty() const {
+            return count == 0;
+        }
+
+    private:
+        std::vector<std::optional<T>> slots;    // Values by descriptor.
+        std::size_t count = 0;                  // Number of present values.
+};
+
+#endif // APPROX_FD_TABLE_H
@@ -0,0 +1,61 @@
+#include "handoff.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "err.h"
+
+// Create the eventfd.
+Notifier::Notifier() : event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (event_fd < 0) {
+        fatal("Failed to create eventfd.");
+    }
+}
+
+// Close the eventfd.
+Notifier::~Notifier() {
+    close(event_fd);
+}
+
+// Make the descriptor readable.
+// The counter can't overflow in practice, so a failed write means it's already readable.
+void Notifier::notify() {
+    uint64_t one = 1;
+    while (write(event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+// Consume all pending notifications, a single read resets the counter.
+void Notifier::clear() {
+    uint64_t count;
+    while (read(event_fd, &count, sizeof(count)) < 0 && errno == EINTR) {}
+}
+
+// Descriptor to watch in an event loop.
+int Notifier::fd() const {
+    return event_fd;
+}
+
+// Queue a connection and wake the worker.
+void Handoff::push(Connection conn) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(conn);
+    }
+
+    wakeup.notify();
+}
+
+// Take all queued connections.
+std::vector<Connection> Handoff::take() {
+    std::vector<Connection> taken;
+    std::lock_guard<std::mutex> lock(mutex);
+    taken.swap(queue);
+    return taken;
+}
+
+// Notifier watched by the worker.
+Notifier& Handoff::notifier() {
+    return wakeup;
+}
@@ -0,0 +1,56 @@
+#ifndef APPROX_HANDOFF_H
+#define APPROX_HANDOFF_H
+
+#include <mutex>
+#include <vector>
+#include <sys/socket.h>
+
+// Accepted connection passed between threads.
+struct Connection {
+    int fd;                     // Client socket.
+    sockaddr_storage addr;      // Client address.
+};
+
+// Wakeup signal between threads based on an eventfd.
+// The descriptor becomes readable after notify() and stays so until clear().
+class Notifier {
+    public:
+        Notifier();
+        ~Notifier();
+
+        Notifier(Notifier const&) = delete;
+        Notifier& operator=(Notifier const&) = delete;
+
+        // Make the descriptor readable.
+        void notify();
+
+        // Consume all pending notifications.
+        void clear();
+
+        // Descriptor to watch in an event loop.
+        int fd() const;
+
+    private:
+        int event_fd;
+};
+
+// Queue of connections handed from the acceptor to a worker thread.
+// Every push wakes the worker through its notifier.
+class Handoff {
+    public:
+        // Queue a connection and wake the worker.
+        void push(Connection conn);
+
+        // Take all queued connections.
+        std::vector<Connection> take();
+
+        // Notifier watched by the worker.
+        Notifier& notifier();
+
+    private:
+        std::mutex mutex;                   // Guards queue.
+        std::vector<Connection> queue;      // Connections not yet taken.
+        Notifier wakeup;                    // Signalled on every push.
+};
+
+#endif // APPROX_HANDOFF_H
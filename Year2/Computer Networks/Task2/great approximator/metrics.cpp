@@ -0,0 +1,138 @@
+#include "metrics.h"
+
+#include <bit>
+#include <sstream>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "err.h"
+
+namespace {
+    // Append a metric with its help and type lines.
+    void put_metric(std::ostringstream& oss, char const* name, char const* type, char const* help,
+                    auto value) {
+        oss << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " " << type << "\n"
+            << name << " " << value << "\n";
+    }
+
+    // Append a histogram, buckets in the exposition format are cumulative.
+    void put_histogram(std::ostringstream& oss, char const* name, char const* help,
+                       Histogram const& histogram) {
+        oss << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " histogram\n";
+
+        uint64_t count = 0;
+        for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+            count += histogram.bucket(i);
+            oss << name << "_bucket{le=\"";
+            if (i + 1 < HISTOGRAM_BUCKETS) {
+                oss << Histogram::bound(i);
+            } else {
+                oss << "+Inf";
+            }
+            oss << "\"} " << count << "\n";
+        }
+
+        oss << name << "_sum " << histogram.sum() << "\n"
+            << name << "_count " << count << "\n";
+    }
+}   // namespace
+
+// Add a value to its bucket, the smallest one with bound not below the value.
+void Histogram::observe(uint64_t value) {
+    std::size_t i = value == 0 ? 0 : 1 + std::bit_width(value - 1);
+    buckets[std::min(i, HISTOGRAM_BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(value, std::memory_order_relaxed);
+}
+
+// Upper bound of a bucket: 0 for the first one, then powers of two.
+uint64_t Histogram::bound(std::size_t bucket) {
+    return bucket == 0 ? 0 : uint64_t{1} << (bucket - 1);
+}
+
+// Render metrics in the Prometheus text exposition format.
+std::string format_metrics(Metrics const& metrics, int64_t uptime_ms, uint64_t log_dropped) {
+    std::ostringstream oss;
+    put_metric(oss, "approx_uptime_seconds", "gauge", "Time since the server started.",
+               static_cast<double>(uptime_ms) / 1000.0);
+    put_metric(oss, "approx_connections_total", "counter", "Accepted connections.",
+               metrics.connections.get());
+    put_metric(oss, "approx_clients", "gauge", "Connected clients.", metrics.clients.get());
+    put_metric(oss, "approx_puts_total", "counter", "Accepted PUTs.", metrics.puts.get());
+    put_metric(oss, "approx_bad_puts_total", "counter", "Sent BAD_PUTs.", metrics.bad_puts.get());
+    put_metric(oss, "approx_penalties_total", "counter", "Sent PENALTYs.", metrics.penalties.get());
+    put_metric(oss, "approx_games_total", "counter", "Finished games.", metrics.games.get());
+    put_metric(oss, "approx_pending_responses", "gauge", "Retarded responses waiting to be sent.",
+               metrics.pending_responses.get());
+    put_metric(oss, "approx_received_bytes_total", "counter", "Bytes received from clients.",
+               metrics.bytes_in.get());
+    put_metric(oss, "approx_sent_bytes_total", "counter", "Bytes sent to clients.",
+               metrics.bytes_out.get());
+    put_metric(oss, "approx_output_bytes", "gauge", "Bytes queued for clients, including retarded responses.",
+               metrics.output_bytes.get());
+    put_metric(oss, "approx_throttled_clients", "gauge", "Clients not read from until their output drains.",
+               metrics.throttled_clients.get());
+    put_metric(oss, "approx_throttles_total", "counter", "Times a client reached its output cap.",
+               metrics.throttles.get());
+    put_metric(oss, "approx_output_overflows_total", "counter",
+               "Clients disconnected for staying over the output cap.", metrics.output_overflows.get());
+    put_metric(oss, "approx_paused_games", "gauge", "Games not reading until their output drains.",
+               metrics.paused_games.get());
+    put_metric(oss, "approx_wakeups_total", "counter", "Event loop wakeups.", metrics.wakeups.get());
+    put_histogram(oss, "approx_wakeup_events", "Events handled per event loop wakeup.",
+                  metrics.wakeup_events);
+    put_histogram(oss, "approx_wakeup_microseconds", "Time spent handling an event loop wakeup.",
+                  metrics.wakeup_us);
+    put_metric(oss, "approx_log_dropped_total", "counter", "Log lines dropped because output fell behind.",
+               log_dropped);
+    return oss.str();
+}
+
+// Create a non-blocking listening socket for metrics, bound to the loopback address.
+int create_metrics_socket(uint16_t port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        fatal("Failed to create metrics socket.");
+    }
+
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        fatal("Failed to bind metrics socket.");
+    }
+    if (listen(sock, SOMAXCONN) < 0) {
+        fatal("Failed to listen on metrics socket.");
+    }
+    if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0) {
+        fatal("Failed to set metrics socket non-blocking.");
+    }
+
+    return sock;
+}
+
+// Accept all waiting metrics connections, send them the text and close them.
+// The text fits in the socket buffer, so a single send doesn't block.
+void serve_metrics(int sock, std::string const& text) {
+    while (true) {
+        int fd = accept(sock, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            return;
+        }
+
+        send(fd, text.data(), text.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        close(fd);
+    }
+}
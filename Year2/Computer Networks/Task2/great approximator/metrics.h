@@ -0,0 +1,101 @@
+#ifndef APPROX_METRICS_H
+#define APPROX_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Counters are updated by all event loop threads without locking,
+// relaxed ordering is enough as no other data is published through them.
+
+// Monotonic counter.
+class Counter {
+    public:
+        void add(uint64_t n = 1) {
+            value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t get() const {
+            return value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> value{0};
+};
+
+// Value that goes up and down.
+class Gauge {
+    public:
+        void add(int64_t n = 1) {
+            value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        void sub(int64_t n = 1) {
+            value.fetch_sub(n, std::memory_order_relaxed);
+        }
+
+        int64_t get() const {
+            return value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<int64_t> value{0};
+};
+
+// Number of histogram buckets, the last one is unbounded.
+constexpr std::size_t HISTOGRAM_BUCKETS = 16;
+
+// Distribution of observed values in buckets with bounds 0, 1, 2, 4, ..., 2^13 and +Inf.
+class Histogram {
+    public:
+        void observe(uint64_t value);
+
+        // Upper bound of a bucket, the last one has none.
+        static uint64_t bound(std::size_t bucket);
+
+        uint64_t bucket(std::size_t i) const {
+            return buckets[i].load(std::memory_order_relaxed);
+        }
+
+        uint64_t sum() const {
+            return total.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, HISTOGRAM_BUCKETS> buckets{};    // Not cumulative.
+        std::atomic<uint64_t> total{0};                                   // Sum of observed values.
+};
+
+// Server metrics, shared by all games.
+struct Metrics {
+    Counter connections{};              // Accepted connections.
+    Gauge clients{};                    // Connected clients.
+    Counter puts{};                     // Accepted PUTs.
+    Counter bad_puts{};                 // Sent BAD_PUTs.
+    Counter penalties{};                // Sent PENALTYs.
+    Counter games{};                    // Finished games.
+    Gauge pending_responses{};          // Retarded responses waiting in timer queues.
+    Counter bytes_in{};                 // Bytes received from clients.
+    Counter bytes_out{};                // Bytes sent to clients.
+    Gauge output_bytes{};               // Bytes queued for clients, including retarded responses.
+    Gauge throttled_clients{};          // Clients not read from, because their output is over the cap.
+    Counter throttles{};                // Times a client reached its output cap.
+    Counter output_overflows{};         // Clients disconnected for staying over the output cap.
+    Gauge paused_games{};               // Games not reading at all, because their output is over the cap.
+    Counter wakeups{};                  // Event loop wakeups.
+    Histogram wakeup_events{};          // Events per wakeup.
+    Histogram wakeup_us{};              // Time spent handling a wakeup, in microseconds.
+};
+
+// Render metrics in the Prometheus text exposition format,
+// along with the number of dropped log lines.
+std::string format_metrics(Metrics const& metrics, int64_t uptime_ms, uint64_t log_dropped);
+
+// Create a non-blocking listening socket for metrics, bound to the loopback address.
+int create_metrics_socket(uint16_t port);
+
+// Accept all waiting metrics connections, send them the text and close them.
+void serve_metrics(int sock, std::string const& text);
+
+#endif // APPROX_METRICS_H
@@ -1,24 +1,13 @@
 #include "protocol.h"
 
-#include <regex>
-#include <sstream>
-#include <iomanip>
-
-// Extract message from buffer.
-// std::nullopt if no complete message is found.
-std::optional<std::string> extract_line(std::string& buffer) {
-    std::size_t pos = buffer.find(DELIMITER);
-    if (pos == std::string::npos) {
-        return std::nullopt;
-    }
-
-    std::string line = buffer.substr(0, pos);
-    buffer.erase(0, pos + 2);
-    return line;
-}
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <limits>
 
 // Extract the message type from a line.
-MessageType get_message_type(std::string const& line) {
+MessageType get_message_type(std::string_view line) {
     if (line.starts_with("HELLO")) {
         return MessageType::HELLO;
     } else if (line.starts_with("COEFF")) {
@@ -29,6 +18,8 @@ MessageType get_message_type(std::string const& line) {
         return MessageType::BAD_PUT;
     } else if (line.starts_with("PENALTY")) {
         return MessageType::PENALTY;
+    } else if (line.starts_with("STATE_DELTA")) {
+        return MessageType::STATE_DELTA;
     } else if (line.starts_with("STATE")) {
         return MessageType::STATE;
     } else if(line.starts_with("SCORING")) {
@@ -38,186 +29,472 @@ MessageType get_message_type(std::string const& line) {
     }
 }
 
-// Validate a HELLO message.
-bool validate_hello(std::string const& line) {
-    static const std::regex pattern(R"(^HELLO [a-zA-Z0-9]+$)");
-    return std::regex_match(line, pattern);
-}
+namespace {
+    // Character classes used by the grammar, ASCII only like regex \d.
+    bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    bool is_alnum(char c) {
+        return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    // Scan a number matching -?\d+(\.\d{0,7})? (or \d+(\.\d{0,7})? without sign)
+    // starting at pos. On success store its value and move pos past it.
+    // Out of range values saturate, as with stream extraction.
+    bool scan_decimal(std::string_view line, std::size_t& pos, bool with_sign, double& value) {
+        std::size_t i = pos;
+        if (with_sign && i < line.size() && line[i] == '-') {
+            ++i;
+        }
+
+        std::size_t digits = i;
+        while (i < line.size() && is_digit(line[i])) {
+            ++i;
+        }
+        if (i == digits) {
+            return false;
+        }
+
+        if (i < line.size() && line[i] == '.') {
+            std::size_t fraction = ++i;
+            while (i < line.size() && is_digit(line[i]) && i - fraction < 7) {
+                ++i;
+            }
+        }
+
+        auto [ptr, ec] = std::from_chars(line.data() + pos, line.data() + i, value);
+        if (ec == std::errc::result_out_of_range) {
+            value = line[pos] == '-' ? std::numeric_limits<double>::lowest()
+                                     : std::numeric_limits<double>::max();
+        }
+
+        pos = i;
+        return true;
+    }
+
+    // Scan a non-negative integer matching \d+ starting at pos.
+    // Values that don't fit in int16_t saturate to its maximum.
+    bool scan_point(std::string_view line, std::size_t& pos, int16_t& point) {
+        std::size_t i = pos;
+        int32_t value = 0;
+
+        while (i < line.size() && is_digit(line[i])) {
+            value = std::min<int32_t>(value * 10 + (line[i] - '0'), std::numeric_limits<int16_t>::max());
+            ++i;
+        }
+        if (i == pos) {
+            return false;
+        }
+
+        point = static_cast<int16_t>(value);
+        pos = i;
+        return true;
+    }
 
-// Validate a COEFF message.
-bool validate_coeff(std::string const& line) {
-    static const std::regex pattern(R"(^COEFF( -?\d+(\.\d{0,7})?)+$)");
-    return std::regex_match(line, pattern);
+    // Scan a keyword followed by one or more " <number>" up to the end of line.
+    std::optional<std::vector<double>> scan_values(std::string_view line, std::string_view keyword) {
+        if (!line.starts_with(keyword)) {
+            return std::nullopt;
+        }
+
+        std::vector<double> values;
+        std::size_t pos = keyword.size();
+        do {
+            double value;
+            if (pos >= line.size() || line[pos] != ' ' || !scan_decimal(line, ++pos, true, value)) {
+                return std::nullopt;
+            }
+            values.push_back(value);
+        } while (pos < line.size());
+
+        return values;
+    }
+
+    // Scan a keyword followed by "<point> <value>" up to the end of line.
+    std::optional<std::pair<int16_t, double>> scan_keyword_point_value(std::string_view line,
+                                                                       std::string_view keyword) {
+        if (!line.starts_with(keyword)) {
+            return std::nullopt;
+        }
+
+        return scan_point_value(line.substr(keyword.size()));
+    }
+}   // namespace
+
+// Validate and parse a "<point> <value>" pair, as in the PUT message.
+std::optional<std::pair<int16_t, double>> scan_point_value(std::string_view text) {
+    std::pair<int16_t, double> res;
+    std::size_t pos = 0;
+
+    if (!scan_point(text, pos, res.first) || pos >= text.size() || text[pos] != ' ' ||
+        !scan_decimal(text, ++pos, true, res.second) || pos != text.size()) {
+        return std::nullopt;
+    }
+
+    return res;
 }
 
-// Validate a PUT message.
-bool validate_put(std::string const& line) {
-    static const std::regex pattern(R"(^PUT \d+ -?\d+(\.\d{0,7})?$)");
-    return std::regex_match(line, pattern);
+// Validate and parse a HELLO message.
+std::optional<std::string_view> scan_hello(std::string_view line) {
+    if (!line.starts_with("HELLO ") || line.size() == HELLO_SIZE) {
+        return std::nullopt;
+    }
+
+    std::string_view player_id = line.substr(HELLO_SIZE);
+    for (char c : player_id) {
+        if (!is_alnum(c)) {
+            return std::nullopt;
+        }
+    }
+
+    return player_id;
 }
 
-// Validate a BAD_PUT message.
-bool validate_bad_put(std::string const& line) {
-    static const std::regex pattern(R"(^BAD_PUT \d+ -?\d+(\.\d{0,7})?$)");
-    return std::regex_match(line, pattern);
+// Validate and parse a HELLO message with optional session options.
+// A suffix is an option only if a player id still precedes it, so that
+// "HELLO DELTA" and "HELLO BINARY" remain plain HELLOs of those players.
+std::optional<std::string_view> scan_hello(std::string_view line, HelloOptions& options) {
+    options = HelloOptions{};
+    auto take_option = [&line](std::string_view suffix) {
+        if (!line.ends_with(suffix) || line.size() <= HELLO_SIZE + suffix.size()) {
+            return false;
+        }
+
+        line.remove_suffix(suffix.size());
+        return true;
+    };
+
+    options.delta = take_option(DELTA_SUFFIX);
+    options.binary = take_option(BINARY_SUFFIX);
+
+    return scan_hello(line);
 }
 
-// Validate a PENALTY message.
-bool validate_penalty(std::string const& line) {
-    static const std::regex pattern(R"(^PENALTY \d+ -?\d+(\.\d{0,7})?$)");
-    return std::regex_match(line, pattern);
+// Validate and parse a COEFF message.
+std::optional<std::vector<double>> scan_coeff(std::string_view line) {
+    return scan_values(line, "COEFF");
 }
 
-// Validate a STATE message.
-bool validate_state(std::string const& line) {
-    static const std::regex pattern(R"(^STATE( -?\d+(\.\d{0,7})?)+$)");
-    return std::regex_match(line, pattern);
+// Validate and parse a PUT message.
+std::optional<std::pair<int16_t, double>> scan_put(std::string_view line) {
+    return scan_keyword_point_value(line, "PUT ");
 }
 
-// Validate a SCORING message.
-bool validate_scoring(std::string const& line) {
-    static const std::regex pattern(R"(^SCORING ([a-zA-Z0-9]+ \d+(\.\d{0,7})?)+$)");
-    return std::regex_match(line, pattern);
+// Validate and parse a BAD_PUT message.
+std::optional<std::pair<int16_t, double>> scan_bad_put(std::string_view line) {
+    return scan_keyword_point_value(line, "BAD_PUT ");
 }
 
-// Parse a HELLO message.
-std::string parse_hello(std::string const& line) {
-    return line.substr(6);
+// Validate and parse a PENALTY message.
+std::optional<std::pair<int16_t, double>> scan_penalty(std::string_view line) {
+    return scan_keyword_point_value(line, "PENALTY ");
 }
 
-// Parse a COEFF message.
-std::vector<double> parse_coeff(std::string const& line) {
-    std::istringstream iss(line.substr(COEFF_SIZE));
-    std::vector<double> coeffs;
-    double coeff;
+// Validate and parse a STATE message.
+std::optional<std::vector<double>> scan_state(std::string_view line) {
+    return scan_values(line, "STATE");
+}
 
-    while (iss >> coeff) {
-        coeffs.push_back(coeff);
+// Validate and parse a STATE_DELTA message.
+std::optional<std::vector<std::pair<int16_t, double>>> scan_state_delta(std::string_view line) {
+    if (!line.starts_with("STATE_DELTA")) {
+        return std::nullopt;
     }
 
-    return coeffs;
+    std::vector<std::pair<int16_t, double>> changes;
+    std::size_t pos = STATE_DELTA_SIZE - 1;
+    do {
+        std::pair<int16_t, double> change;
+        if (pos >= line.size() || line[pos] != ' ' || !scan_point(line, ++pos, change.first) ||
+            pos >= line.size() || line[pos] != ' ' || !scan_decimal(line, ++pos, true, change.second)) {
+            return std::nullopt;
+        }
+        changes.push_back(change);
+    } while (pos < line.size());
+
+    return changes;
 }
 
-// Parse a PUT message.
-std::pair<int16_t, double> parse_put(std::string const& line) {
-    std::istringstream iss(line.substr(PUT_SIZE));
-    std::pair<int16_t, double> res;
-    iss >> res.first >> res.second;
-    return res;
+// Check whether the line is a bare "STATE", a client's request for a full STATE.
+bool scan_state_request(std::string_view line) {
+    return line == "STATE";
 }
 
-// Parse BAD_PUT message.
-std::pair<int16_t, double> parse_bad_put(std::string const& line) {
-    std::istringstream iss(line.substr(BAD_PUT_SIZE));
-    std::pair<int16_t, double> res;
-    iss >> res.first >> res.second;
-    return res;
-}
+// Validate and parse a SCORING message.
+// The grammar repeats "<player_id> <score>" groups without a separator, so
+// after splitting on spaces the first token is an id, the last one a score,
+// and every token in between is a score directly followed by the next id.
+// As groups may be split in many ways, the message is validated token by token
+// first and then read the same way as stream extraction would.
+std::optional<std::vector<std::pair<std::string, double>>> scan_scoring(std::string_view line) {
+    if (!line.starts_with("SCORING ")) {
+        return std::nullopt;
+    }
 
-// Prase a PENALTY message.
-std::pair<int16_t, double> parse_penalty(std::string const& line) {
-    std::istringstream iss(line.substr(PENALTY_SIZE));
-    std::pair<int16_t, double> res;
-    iss >> res.first >> res.second;
-    return res;
+    // First token: player id.
+    std::size_t pos = SCORING_SIZE;
+    while (pos < line.size() && is_alnum(line[pos])) {
+        ++pos;
+    }
+    if (pos == SCORING_SIZE || pos >= line.size() || line[pos] != ' ') {
+        return std::nullopt;
+    }
+
+    // Middle tokens: \d+(\.\d{0,7})?[a-zA-Z0-9]+, that is a digit followed by
+    // alphanumerics, or digits followed by a dot and alphanumerics.
+    std::size_t token = pos + 1;
+    std::size_t token_end;
+    while ((token_end = line.find(' ', token)) != std::string_view::npos) {
+        std::size_t digits = token;
+        while (digits < token_end && is_digit(line[digits])) {
+            ++digits;
+        }
+        if (digits == token) {
+            return std::nullopt;
+        }
+
+        std::size_t id = digits < token_end && line[digits] == '.' ? digits + 1 : token + 1;
+        if (id >= token_end) {
+            return std::nullopt;
+        }
+        for (std::size_t i = id; i < token_end; ++i) {
+            if (!is_alnum(line[i])) {
+                return std::nullopt;
+            }
+        }
+
+        token = token_end + 1;
+    }
+
+    // Last token: score.
+    double score;
+    pos = token;
+    if (!scan_decimal(line, pos, false, score) || pos != line.size()) {
+        return std::nullopt;
+    }
+
+    // Read alternating whitespace separated ids and greedy number prefixes.
+    std::vector<std::pair<std::string, double>> scoring;
+    pos = SCORING_SIZE;
+    while (pos < line.size()) {
+        std::size_t id_end = std::min(line.find(' ', pos), line.size());
+        std::string_view player_id = line.substr(pos, id_end - pos);
+        if (id_end == line.size()) {
+            break;
+        }
+
+        std::size_t start = pos = id_end + 1;
+        while (pos < line.size() && is_digit(line[pos])) {
+            ++pos;
+        }
+        if (pos < line.size() && line[pos] == '.') {
+            ++pos;
+        }
+        while (pos < line.size() && is_digit(line[pos])) {
+            ++pos;
+        }
+        if (pos == start) {
+            break;
+        }
+
+        std::from_chars(line.data() + start, line.data() + pos, score);
+        scoring.emplace_back(player_id, score);
+
+        if (pos < line.size() && line[pos] == ' ') {
+            ++pos;
+        }
+    }
+
+    return scoring;
 }
 
-// Parse a STATE message.
-std::vector<double> parse_state(std::string const& line) {
-    std::istringstream iss(line.substr(STATE_SIZE));
-    std::vector<double> values;
-    double val;
+// Parse coefficients of a COEFF line without validating it.
+// Stops at the first token that is not a number.
+std::vector<double> parse_coeff(std::string_view line) {
+    std::vector<double> coeffs;
+    std::size_t pos = std::min(COEFF_SIZE, line.size());
+
+    while (true) {
+        while (pos < line.size() && std::isspace(static_cast<unsigned char>(line[pos]))) {
+            ++pos;
+        }
+
+        double coeff;
+        auto [ptr, ec] = std::from_chars(line.data() + pos, line.data() + line.size(), coeff);
+        if (ec != std::errc{}) {
+            break;
+        }
 
-    while (iss >> val) {
-        values.push_back(val);
+        coeffs.push_back(coeff);
+        pos = ptr - line.data();
     }
 
-    return values;
+    return coeffs;
 }
 
-// Parse a SCORING message.
-std::vector<std::pair<std::string, double>> parse_scoring(std::string const& line) {
-    std::istringstream iss(line.substr(SCORING_SIZE));
+namespace {
+    // Longest text of a formatted value: sign, 309 integer digits of the
+    // largest double, the point and 7 decimal places.
+    constexpr std::size_t VALUE_TEXT_SIZE = 1 + std::numeric_limits<double>::max_exponent10 + 1 + 1 + 7;
 
-    std::vector<std::pair<std::string, double>> scoring;
-    std::string player_id;
-    double score;
-    while (iss >> player_id >> score) {
-        scoring.emplace_back(player_id, score);
+    // Text length of a typical value, used to size messages up front.
+    constexpr std::size_t VALUE_TEXT_ESTIMATE = 12;
+
+    void append_point(std::string& out, int16_t point) {
+        char text[8];
+        auto [end, ec] = std::to_chars(text, text + sizeof(text), point);
+        out.append(text, end);
     }
 
-    return scoring;
+    // Build "<keyword> <point> <value>\r\n".
+    std::string build_point_value(std::string_view keyword, int16_t point, double value) {
+        std::string message;
+        message.reserve(keyword.size() + 8 + VALUE_TEXT_ESTIMATE + 2);
+        message += keyword;
+        append_point(message, point);
+        message += ' ';
+        append_value(message, value);
+        message += DELIMITER;
+        return message;
+    }
+
+    // Build "<keyword> <value>...\r\n".
+    std::string build_values(std::string_view keyword, std::span<double const> values) {
+        std::string message;
+        message.reserve(keyword.size() + values.size() * VALUE_TEXT_ESTIMATE + 2);
+        message += keyword;
+        append_values(message, values);
+        message += DELIMITER;
+        return message;
+    }
+}   // namespace
+
+// Append a value with 7 decimal places without going through a stream.
+// Values below FAST_LIMIT, which the game produces, are scaled to an integer
+// number of 1e-7 units. The product is rounded, so fma recovers its exact error
+// to round the true value like printf's "%.7f" does, to nearest, ties to even.
+// Other values go through std::to_chars, which rounds the same way.
+void append_value(std::string& out, double value) {
+    constexpr double FAST_LIMIT = 1e8;
+    constexpr double SCALE = 1e7;
+
+    char text[VALUE_TEXT_SIZE];
+    if (!(std::fabs(value) < FAST_LIMIT)) {
+        auto [end, ec] = std::to_chars(text, text + sizeof(text), value, std::chars_format::fixed, 7);
+        out.append(text, end);
+        return;
+    }
+
+    double product = value * SCALE;
+    double error = std::fma(value, SCALE, -product);
+    double units = std::nearbyint(product);
+    double rest = product - units;
+    if (rest == 0.5 && error > 0) {
+        units += 1;
+    } else if (rest == -0.5 && error < 0) {
+        units -= 1;
+    }
+
+    // Digits from the end: 7 decimal places, the point and the integer part.
+    uint64_t magnitude = static_cast<uint64_t>(std::fabs(units));
+    char* end = text + sizeof(text);
+    char* pos = end;
+    for (int i = 0; i < 7; ++i) {
+        *--pos = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    }
+    *--pos = '.';
+    do {
+        *--pos = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (std::signbit(value)) {
+        *--pos = '-';
+    }
+
+    out.append(pos, end);
+}
+
+// Append " <value>" for each value.
+void append_values(std::string& out, std::span<double const> values) {
+    for (double value : values) {
+        out += ' ';
+        append_value(out, value);
+    }
 }
 
 // Build a HELLO message.
-std::string build_hello(std::string const& player_id) {
-    std::ostringstream oss;
-    oss << "HELLO " << player_id << DELIMITER;
-    return oss.str();
+std::string build_hello(std::string const& player_id, HelloOptions options) {
+    std::string message = "HELLO " + player_id;
+    if (options.binary) {
+        message += BINARY_SUFFIX;
+    }
+    if (options.delta) {
+        message += DELTA_SUFFIX;
+    }
+    message += DELIMITER;
+    return message;
 }
 
 // Build a COEFF message.
 std::string build_coeff(std::vector<double> const& coeffs) {
-    std::ostringstream oss;
-    oss << "COEFF";
-
-    for (const auto& coeff : coeffs) {
-        oss << " " << std::fixed << std::setprecision(7) << coeff;
-    }
-
-    oss << DELIMITER;
-    return oss.str();
+    return build_values("COEFF", coeffs);
 }
 
 // Build a PUT message.
 std::string build_put(int16_t point, double value) {
-    std::ostringstream oss;
-    oss << "PUT " << static_cast<int>(point) << " " 
-        << std::fixed << std::setprecision(7) << value 
-        << DELIMITER;
-    return oss.str();
+    return build_point_value("PUT ", point, value);
 }
 
 // Build a BAD_PUT message.
 std::string build_bad_put(int16_t point, double value) {
-    std::ostringstream oss;
-    oss << "BAD_PUT " << static_cast<int>(point) << " " 
-        << std::fixed << std::setprecision(7) << value 
-        << DELIMITER;
-    return oss.str();
+    return build_point_value("BAD_PUT ", point, value);
 }
 
 // Build a PENALTY message.
 std::string build_penalty(int16_t point, double value) {
-    std::ostringstream oss;
-    oss << "PENALTY " << static_cast<int>(point) << " " 
-        << std::fixed << std::setprecision(7) << value 
-        << DELIMITER;
-    return oss.str();
+    return build_point_value("PENALTY ", point, value);
 }
 
 // Build a STATE message.
 std::string build_state(std::vector<double> const& values) {
-    std::ostringstream oss;
-    oss << "STATE";
+    return build_values("STATE", values);
+}
 
-    for (const auto& val : values) {
-        oss << " " << std::fixed << std::setprecision(7) << val;
+// Build a STATE_DELTA message with new values at the changed points.
+std::string build_state_delta(std::vector<std::pair<int16_t, double>> const& changes) {
+    std::string message;
+    message.reserve(STATE_DELTA_SIZE + changes.size() * (8 + VALUE_TEXT_ESTIMATE) + 2);
+    message += "STATE_DELTA";
+
+    for (const auto& [point, value] : changes) {
+        message += ' ';
+        append_point(message, point);
+        message += ' ';
+        append_value(message, value);
     }
 
-    oss << DELIMITER;
-    return oss.str();
+    message += DELIMITER;
+    return message;
+}
+
+// Build a request for a full STATE.
+std::string build_state_request() {
+    return std::string("STATE") + DELIMITER;
 }
 
 // Build a SCORING message.
 std::string build_scoring(std::vector<std::pair<std::string, double>> const& scoring) {
-    std::ostringstream oss;
-    oss << "SCORING";
+    std::string message = "SCORING";
 
     for (const auto& [player_id, score] : scoring) {
-        oss << " " << player_id << " " << std::fixed << std::setprecision(7) << score;
+        message += ' ';
+        message += player_id;
+        message += ' ';
+        append_value(message, score);
     }
 
-    oss << DELIMITER;
-    return oss.str();
-}
\ No newline at end of file
+    message += DELIMITER;
+    return message;
+}
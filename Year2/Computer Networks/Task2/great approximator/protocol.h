@@ -1,8 +1,10 @@
 #ifndef APPROX_PROTOCOL_H
 #define APPROX_PROTOCOL_H
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <optional>
+#include <span>
 #include <vector>
 
 // Simple message type enumeration for the protocol.
@@ -13,6 +15,7 @@ enum class MessageType {
     BAD_PUT,
     PENALTY,
     STATE,
+    STATE_DELTA,
     SCORING,
     ERROR
 };
@@ -24,45 +27,67 @@ constexpr std::size_t PUT_SIZE = 4;
 constexpr std::size_t BAD_PUT_SIZE = 8;
 constexpr std::size_t PENALTY_SIZE = 8;
 constexpr std::size_t STATE_SIZE = 6;
+constexpr std::size_t STATE_DELTA_SIZE = 12;
 constexpr std::size_t SCORING_SIZE = 8;
 
 // Delimiter used in the protocol.
 constexpr char const* DELIMITER = "\r\n";
 
-// Extract message from buffer.
-// std::nullopt if no complete message is found.
-std::optional<std::string> extract_line(std::string& buffer);
+// Suffixes of a HELLO message requesting session options, in this order.
+// BINARY: binary framing for the rest of the session.
+// DELTA: accepted PUTs are answered with STATE_DELTA, except for periodic full STATEs.
+constexpr std::string_view BINARY_SUFFIX = " BINARY";
+constexpr std::string_view DELTA_SUFFIX = " DELTA";
+
+// Session options requested in HELLO.
+struct HelloOptions {
+    bool binary{};      // Binary framing.
+    bool delta{};       // STATE_DELTA responses.
+};
 
 // Extract the message type from a line.
-MessageType get_message_type(std::string const& line);
+MessageType get_message_type(std::string_view line);
+
+// Validate and parse the message based on its type in a single pass.
+// std::nullopt if the message does not match the protocol grammar,
+// no description is provided in that case.
+// Points that don't fit in int16_t saturate to its maximum.
+std::optional<std::string_view> scan_hello(std::string_view line);
+std::optional<std::string_view> scan_hello(std::string_view line, HelloOptions& options);
+std::optional<std::vector<double>> scan_coeff(std::string_view line);
+std::optional<std::pair<int16_t, double>> scan_put(std::string_view line);
+std::optional<std::pair<int16_t, double>> scan_bad_put(std::string_view line);
+std::optional<std::pair<int16_t, double>> scan_penalty(std::string_view line);
+std::optional<std::vector<double>> scan_state(std::string_view line);
+std::optional<std::vector<std::pair<int16_t, double>>> scan_state_delta(std::string_view line);
+std::optional<std::vector<std::pair<std::string, double>>> scan_scoring(std::string_view line);
+
+// Validate and parse a "<point> <value>" pair, as in the PUT message.
+std::optional<std::pair<int16_t, double>> scan_point_value(std::string_view text);
+
+// Check whether the line is a bare "STATE", a client's request for a full STATE.
+bool scan_state_request(std::string_view line);
+
+// Parse coefficients of a COEFF line without validating it.
+// Stops at the first token that is not a number.
+std::vector<double> parse_coeff(std::string_view line);
 
-// Validate the message based on its type.
-// No description is provided if the validation fails.
-bool validate_hello(std::string const& line);
-bool validate_coeff(std::string const& line);
-bool validate_put(std::string const& line);
-bool validate_bad_put(std::string const& line);
-bool validate_penalty(std::string const& line);
-bool validate_state(std::string const& line);
-bool validate_scoring(std::string const& line);
+// Append a value with 7 decimal places, as std::fixed << std::setprecision(7)
+// in the "C" locale prints it, without going through a stream.
+void append_value(std::string& out, double value);
 
-// Parse the message based on its type into appropriate data structures.
-// Assumes that the message has been validated.
-std::string parse_hello(std::string const& line);
-std::vector<double> parse_coeff(std::string const& line);
-std::pair<int16_t, double> parse_put(std::string const& line);
-std::pair<int16_t, double> parse_bad_put(std::string const& line);
-std::pair<int16_t, double> parse_penalty(std::string const& line);
-std::vector<double> parse_state(std::string const& line);
-std::vector<std::pair<std::string, double>> parse_scoring(std::string const& line);
+// Append " <value>" for each value.
+void append_values(std::string& out, std::span<double const> values);
 
 // Build messages for sending.
-std::string build_hello(std::string const& player_id);
+std::string build_hello(std::string const& player_id, HelloOptions options = {});
 std::string build_coeff(std::vector<double> const& coeffs);
 std::string build_put(int16_t point, double value);
 std::string build_bad_put(int16_t point, double value);
 std::string build_penalty(int16_t point, double value);
 std::string build_state(std::vector<double> const& values);
+std::string build_state_delta(std::vector<std::pair<int16_t, double>> const& changes);
+std::string build_state_request();
 std::string build_scoring(std::vector<std::pair<std::string, double>> const& scoring);
 
 #endif  // APPROX_PROTOCOL_H
\ No newline at end of file
@@ -0,0 +1,271 @@
+#include "recording.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "err.h"
+
+namespace {
+    // File signature and format version.
+    constexpr char MAGIC[4] = {'A', 'P', 'X', 'R'};
+    constexpr uint8_t VERSION = 1;
+
+    // Buffered bytes that trigger a write.
+    constexpr std::size_t FLUSH_SIZE = 1 << 20;
+
+    // Append an unsigned LEB128 number.
+    void put_varint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    // Size of the meaningful part of an address.
+    std::size_t address_size(sockaddr_storage const& addr) {
+        switch (addr.ss_family) {
+            case AF_INET:
+                return sizeof(sockaddr_in);
+            case AF_INET6:
+                return sizeof(sockaddr_in6);
+            default:
+                return sizeof(sockaddr_storage);
+        }
+    }
+}   // namespace
+
+// Create the file and write the header, exits the program on failure.
+Recorder::Recorder(std::string const& path, RecordingHeader const& header) {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fatal("Failed to create recording file.");
+    }
+
+    buffer.append(MAGIC, sizeof(MAGIC));
+    buffer.push_back(static_cast<char>(VERSION));
+    put_varint(buffer, header.k);
+    put_varint(buffer, header.n);
+    put_varint(buffer, header.m);
+}
+
+// Write buffered records and close the file.
+Recorder::~Recorder() {
+    end_wakeup();
+    flush();
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+void Recorder::connect(int64_t time, int client_fd, sockaddr_storage const& addr) {
+    begin(RecordType::CONNECT, time);
+    put_varint(buffer, client_fd);
+
+    std::size_t size = address_size(addr);
+    buffer.push_back(static_cast<char>(size));
+    buffer.append(reinterpret_cast<char const*>(&addr), size);
+}
+
+void Recorder::data(int64_t time, int client_fd, std::string_view bytes) {
+    begin(RecordType::DATA, time);
+    put_varint(buffer, client_fd);
+    put_varint(buffer, bytes.size());
+    buffer.append(bytes);
+}
+
+void Recorder::close(int64_t time, int client_fd) {
+    begin(RecordType::CLOSE, time);
+    put_varint(buffer, client_fd);
+}
+
+void Recorder::tick(int64_t time) {
+    begin(RecordType::TICK, time);
+}
+
+// Mark the end of a wakeup, if anything was recorded during it.
+// Full buffers are written here, so a wakeup costs at most one write.
+void Recorder::end_wakeup() {
+    if (!in_wakeup) {
+        return;
+    }
+
+    begin(RecordType::WAKEUP_END, last_time);
+    in_wakeup = false;
+    if (buffer.size() >= FLUSH_SIZE) {
+        flush();
+    }
+}
+
+// Start a record, the clock never goes back, so the delta is unsigned.
+void Recorder::begin(RecordType type, int64_t time) {
+    buffer.push_back(static_cast<char>(type));
+    put_varint(buffer, static_cast<uint64_t>(std::max<int64_t>(time - last_time, 0)));
+    last_time = std::max(time, last_time);
+    in_wakeup = true;
+}
+
+// Write all buffered records, stop recording on errors.
+void Recorder::flush() {
+    std::string_view pending = buffer;
+    while (fd >= 0 && !pending.empty()) {
+        ssize_t written = write(fd, pending.data(), pending.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            syserr("Failed to write recording, recording stopped");
+            ::close(fd);
+            fd = -1;
+            break;
+        }
+
+        pending.remove_prefix(written);
+    }
+
+    buffer.clear();
+}
+
+// Map the file and read the header, exits the program on failure.
+RecordingReader::RecordingReader(std::string const& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fatal("Failed to open recording file.");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fatal("Failed to stat recording file.");
+    }
+    length = static_cast<std::size_t>(st.st_size);
+
+    if (length > 0) {
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            fatal("Failed to map recording file.");
+        }
+        data = static_cast<char*>(mapped);
+        madvise(data, length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    if (length < sizeof(MAGIC) + 1 || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+        fatal("Not a recording file.");
+    }
+    pos = sizeof(MAGIC);
+    if (read_byte() != VERSION) {
+        fatal("Unsupported recording version.");
+    }
+
+    head.k = static_cast<uint16_t>(read_varint());
+    head.n = static_cast<uint8_t>(read_varint());
+    head.m = static_cast<uint32_t>(read_varint());
+}
+
+// Unmap the file.
+RecordingReader::~RecordingReader() {
+    if (data) {
+        munmap(data, length);
+    }
+}
+
+RecordingHeader const& RecordingReader::header() const {
+    return head;
+}
+
+// Read the next record, false at the end of the file.
+bool RecordingReader::next(Record& record) {
+    if (pos == length) {
+        return false;
+    }
+
+    record.type = static_cast<RecordType>(read_byte());
+    time += static_cast<int64_t>(read_varint());
+    record.time = time;
+
+    switch (record.type) {
+        case RecordType::CONNECT: {
+            record.fd = static_cast<int>(read_varint());
+            std::size_t size = read_byte();
+            if (size > sizeof(record.addr) || length - pos < size) {
+                fatal("Malformed recording.");
+            }
+
+            record.addr = sockaddr_storage{};
+            std::memcpy(&record.addr, data + pos, size);
+            pos += size;
+            break;
+        }
+
+        case RecordType::DATA: {
+            record.fd = static_cast<int>(read_varint());
+            uint64_t size = read_varint();
+            if (length - pos < size) {
+                fatal("Malformed recording.");
+            }
+
+            record.data = std::string_view(data + pos, size);
+            pos += size;
+            break;
+        }
+
+        case RecordType::CLOSE:
+            record.fd = static_cast<int>(read_varint());
+            break;
+
+        case RecordType::TICK:
+        case RecordType::WAKEUP_END:
+            break;
+
+        default:
+            fatal("Malformed recording.");
+    }
+
+    return true;
+}
+
+// Read an unsigned LEB128 number.
+uint64_t RecordingReader::read_varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = read_byte();
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+
+    fatal("Malformed recording.");
+}
+
+uint8_t RecordingReader::read_byte() {
+    if (pos == length) {
+        fatal("Malformed recording.");
+    }
+
+    return static_cast<uint8_t>(data[pos++]);
+}
+
+void Digest::update(std::string_view bytes) {
+    for (char c : bytes) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3;
+    }
+    this->bytes += bytes.size();
+}
+
+uint64_t Digest::value() const {
+    return hash;
+}
+
+// Number of digested bytes.
+std::size_t Digest::size() const {
+    return bytes;
+}
@@ -0,0 +1,110 @@
+#ifndef APPROX_RECORDING_H
+#define APPROX_RECORDING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+
+// Kinds of recorded server events.
+enum class RecordType : uint8_t {
+    CONNECT = 1,        // Connection added to the game.
+    DATA = 2,           // Chunk of bytes received from a client.
+    CLOSE = 3,          // Connection closed by the client or failed.
+    TICK = 4,           // Due timers fired.
+    WAKEUP_END = 5      // End of an event loop wakeup with recorded events.
+};
+
+// Game parameters a recording was made with, replays must use the same.
+struct RecordingHeader {
+    uint16_t k;
+    uint8_t n;
+    uint32_t m;
+};
+
+// Single recorded event.
+struct Record {
+    RecordType type;
+    int64_t time;               // Server clock when the event was handled.
+    int fd;                     // Client socket, unused by TICK and WAKEUP_END.
+    sockaddr_storage addr;      // Client address, CONNECT only.
+    std::string_view data;      // Received bytes, DATA only, valid while the reader lives.
+};
+
+// Writer of a compact binary recording of a game session.
+// Records are a type byte, the clock delta from the previous record and varint
+// encoded fields, buffered and written in large chunks.
+// Recording stops with an error message if the file can't be written.
+class Recorder {
+    public:
+        // Create the file and write the header, exits the program on failure.
+        Recorder(std::string const& path, RecordingHeader const& header);
+
+        // Write buffered records and close the file.
+        ~Recorder();
+
+        Recorder(Recorder const&) = delete;
+        Recorder& operator=(Recorder const&) = delete;
+
+        void connect(int64_t time, int client_fd, sockaddr_storage const& addr);
+        void data(int64_t time, int client_fd, std::string_view bytes);
+        void close(int64_t time, int client_fd);
+        void tick(int64_t time);
+
+        // Mark the end of a wakeup, if anything was recorded during it.
+        void end_wakeup();
+
+    private:
+        void begin(RecordType type, int64_t time);
+        void flush();
+
+        int fd{-1};                 // Recording file, -1 after a write error.
+        std::string buffer{};       // Records not written yet.
+        int64_t last_time{};        // Time of the previous record.
+        bool in_wakeup{};           // Whether records were added since the last WAKEUP_END.
+};
+
+// Reader of a recording, mapped into memory.
+class RecordingReader {
+    public:
+        // Map the file and read the header, exits the program on failure.
+        explicit RecordingReader(std::string const& path);
+        ~RecordingReader();
+
+        RecordingReader(RecordingReader const&) = delete;
+        RecordingReader& operator=(RecordingReader const&) = delete;
+
+        RecordingHeader const& header() const;
+
+        // Read the next record, false at the end of the file.
+        // Exits the program if the recording is malformed.
+        bool next(Record& record);
+
+    private:
+        uint64_t read_varint();
+        uint8_t read_byte();
+
+        char* data{};               // Mapped file, nullptr if empty.
+        std::size_t length{};       // File size.
+        std::size_t pos{};          // Read position.
+        int64_t time{};             // Time of the previous record.
+        RecordingHeader head{};
+};
+
+// Running FNV-1a digest of the bytes a replay sends, equal digests mean equal output.
+class Digest {
+    public:
+        void update(std::string_view bytes);
+
+        uint64_t value() const;
+
+        // Number of digested bytes.
+        std::size_t size() const;
+
+    private:
+        uint64_t hash = 0xcbf29ce484222325;
+        std::size_t bytes = 0;
+};
+
+#endif // APPROX_RECORDING_H
@@ -0,0 +1,56 @@
+#include "timer_queue.h"
+
+#include <algorithm>
+
+// Heap order on bucket heads, earliest deadline on top.
+bool TimerQueue::later(std::deque<Timer> const* a, std::deque<Timer> const* b) {
+    Timer const& x = a->front();
+    Timer const& y = b->front();
+    return x.deadline != y.deadline ? x.deadline > y.deadline : x.seq > y.seq;
+}
+
+// Schedule a timer firing delay milliseconds after now.
+void TimerQueue::push(int64_t now, int64_t delay, uint64_t client_id, int fd,
+                      TimerType type, std::string message) {
+    std::deque<Timer>& bucket = buckets[delay];
+    bucket.push_back({now + delay, next_seq++, client_id, fd, type, std::move(message)});
+    ++count;
+
+    // Bucket just became non-empty, its head has to enter the heap.
+    if (bucket.size() == 1) {
+        heads.push_back(&bucket);
+        std::push_heap(heads.begin(), heads.end(), later);
+    }
+}
+
+// Remove and return the earliest timer.
+Timer TimerQueue::pop() {
+    std::pop_heap(heads.begin(), heads.end(), later);
+    std::deque<Timer>* bucket = heads.back();
+
+    Timer timer = std::move(bucket->front());
+    bucket->pop_front();
+    --count;
+
+    // Put the bucket back with its new head, or drop it if it is empty.
+    if (bucket->empty()) {
+        heads.pop_back();
+    } else {
+        std::push_heap(heads.begin(), heads.end(), later);
+    }
+
+    return timer;
+}
+
+// Deadline of the earliest timer.
+int64_t TimerQueue::next_deadline() const {
+    return heads.front()->front().deadline;
+}
+
+bool TimerQueue::empty() const {
+    return count == 0;
+}
+
+std::size_t TimerQueue::size() const {
+    return count;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef APPROX_TIMER_QUEUE_H
+#define APPROX_TIMER_QUEUE_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Kinds of delayed actions scheduled by the server.
+enum class TimerType {
+    RESPONSE,           // Send a retarded response.
+    HELLO_TIMEOUT,      // Disconnect the client if it did not send HELLO.
+    OUTPUT_TIMEOUT      // Disconnect the client if its output is still over the cap,
+                        // or its SCORING is still unsent.
+};
+
+// Single delayed action.
+struct Timer {
+    int64_t deadline;       // Clock time at which the timer fires.
+    uint64_t seq;           // Insertion number, keeps timers with equal deadlines in order.
+    uint64_t client_id;     // Unique id of the client the timer belongs to.
+    int fd;                 // Client socket.
+    TimerType type;         // What to do when the timer fires.
+    std::string message;    // Response to send.
+};
+
+// Queue of timers ordered by deadline.
+// Timers are grouped into FIFO buckets by their delay. As the clock is monotonic,
+// deadlines inside a bucket never decrease, so inserting is an O(1) append and
+// only the bucket heads are kept in a heap. The number of distinct delays is small
+// (PENALTY, BAD_PUT, HELLO and output timeouts and one per player retardation), so expiring
+// is O(1) amortized in the number of timers and the next deadline is always at hand.
+class TimerQueue {
+    public:
+        // Schedule a timer firing delay milliseconds after now.
+        void push(int64_t now, int64_t delay, uint64_t client_id, int fd,
+                  TimerType type, std::string message = {});
+
+        // Remove and return the earliest timer. Queue must not be empty.
+        Timer pop();
+
+        // Deadline of the earliest timer. Queue must not be empty.
+        int64_t next_deadline() const;
+
+        bool empty() const;
+        std::size_t size() const;
+
+    private:
+        // Heap order on bucket heads, earliest deadline on top.
+        static bool later(std::deque<Timer> const* a, std::deque<Timer> const* b);
+
+        std::unordered_map<int64_t, std::deque<Timer>> buckets;     // Timers by delay.
+        std::vector<std::deque<Timer>*> heads;                      // Heap of non-empty buckets.
+        uint64_t next_seq = 0;                                      // Next insertion number.
+        std::size_t count = 0;                                      // Number of queued timers.
+};
+
+#endif // APPROX_TIMER_QUEUE_H
\ No newline at end of file
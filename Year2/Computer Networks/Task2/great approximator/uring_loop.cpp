@@ -0,0 +1,585 @@
+#include "uring_loop.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "err.h"
+
+namespace {
+    // Ring sizes, completions get more room as multishot operations post many.
+    constexpr unsigned SQ_ENTRIES = 1024;
+    constexpr unsigned CQ_ENTRIES = 8192;
+
+    // Buffers provided for receives, the count must be a power of two.
+    constexpr unsigned BUFFER_COUNT = 1024;
+    constexpr std::size_t BUFFER_SIZE = 2048;
+    constexpr uint16_t BUFFER_GROUP = 0;
+
+    // Most messages taken by a single send.
+    constexpr std::size_t MAX_SEND_MESSAGES = 64;
+
+    // Operation kinds stored in the top byte of user_data.
+    constexpr uint64_t OP_POLL = 1;
+    constexpr uint64_t OP_ACCEPT = 2;
+    constexpr uint64_t OP_RECV = 3;
+    constexpr uint64_t OP_SEND = 4;
+    constexpr uint64_t OP_CANCEL = 5;
+
+    // Generations are kept in 24 bits of user_data.
+    constexpr uint32_t GENERATION_MASK = (1u << 24) - 1;
+
+    // user_data: operation kind, generation of the registration, descriptor or send slot.
+    uint64_t pack(uint64_t op, uint32_t generation, uint32_t index) {
+        return op << 56 | static_cast<uint64_t>(generation & GENERATION_MASK) << 32 | index;
+    }
+
+    uint64_t op_of(uint64_t user_data) {
+        return user_data >> 56;
+    }
+
+    uint32_t generation_of(uint64_t user_data) {
+        return (user_data >> 32) & GENERATION_MASK;
+    }
+
+    uint32_t index_of(uint64_t user_data) {
+        return static_cast<uint32_t>(user_data);
+    }
+
+    // Shared ring fields are written by the kernel concurrently.
+    unsigned load_acquire(unsigned const* p) {
+        return std::atomic_ref<unsigned const>(*p).load(std::memory_order_acquire);
+    }
+
+    void store_release(unsigned* p, unsigned value) {
+        std::atomic_ref<unsigned>(*p).store(value, std::memory_order_release);
+    }
+
+    short to_poll_mask(uint32_t interest) {
+        short mask = 0;
+        if (interest & EVENT_READ) {
+            mask |= POLLIN;
+        }
+        if (interest & EVENT_WRITE) {
+            mask |= POLLOUT;
+        }
+
+        return mask;
+    }
+}   // namespace
+
+// Set up the ring, nullptr if the kernel lacks io_uring or needed features.
+std::unique_ptr<UringLoop> UringLoop::create() {
+    std::unique_ptr<UringLoop> loop(new UringLoop());
+    if (!loop->setup()) {
+        return nullptr;
+    }
+
+    return loop;
+}
+
+// Create and map the rings, register the provided buffers.
+bool UringLoop::setup() {
+    // Completions are only processed when waiting, which is also the cheapest mode.
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER
+                 | IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = CQ_ENTRIES;
+    ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, SQ_ENTRIES, &params));
+    if (ring_fd < 0 && errno == EINVAL) {
+        // Older kernels reject the flags they don't know.
+        params = io_uring_params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = CQ_ENTRIES;
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, SQ_ENTRIES, &params));
+    }
+    if (ring_fd < 0) {
+        return false;
+    }
+
+    uint32_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & needed) != needed) {
+        errno = ENOTSUP;
+        return false;
+    }
+
+    // Multishot receive came with Linux 6.0, as did zero copy sends, which can be probed.
+    std::vector<char> probe_storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    auto* probe = reinterpret_cast<io_uring_probe*>(probe_storage.data());
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0
+        || probe->last_op < IORING_OP_SEND_ZC
+        || !(probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED)) {
+        errno = ENOTSUP;
+        return false;
+    }
+
+    sq_entries = params.sq_entries;
+    ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                         params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring_fd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+        ring = nullptr;
+        return false;
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* mapped = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_fd, IORING_OFF_SQES);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(mapped);
+
+    char* base = static_cast<char*>(ring);
+    sq_head = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+    local_tail = *sq_tail;
+
+    // Provided buffers: a ring of descriptors shared with the kernel and their storage.
+    mapped = mmap(nullptr, BUFFER_COUNT * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    buf_ring = static_cast<io_uring_buf_ring*>(mapped);
+
+    mapped = mmap(nullptr, BUFFER_COUNT * BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    buffers = static_cast<char*>(mapped);
+
+    for (unsigned i = 0; i < BUFFER_COUNT; ++i) {
+        recycle(static_cast<uint16_t>(i), i);
+    }
+    std::atomic_ref<uint16_t>(buf_ring->tail).store(BUFFER_COUNT, std::memory_order_release);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return false;
+    }
+
+
+    return true;
+}
+
+// Unmap everything and close the ring, which cancels all operations.
+UringLoop::~UringLoop() {
+    if (ring_fd >= 0) {
+        close(ring_fd);
+    }
+    if (buffers) {
+        munmap(buffers, BUFFER_COUNT * BUFFER_SIZE);
+    }
+    if (buf_ring) {
+        munmap(buf_ring, BUFFER_COUNT * sizeof(io_uring_buf));
+    }
+    if (sqes) {
+        munmap(sqes, sqes_size);
+    }
+    if (ring) {
+        munmap(ring, ring_size);
+    }
+}
+
+// Registration of a descriptor, created on first use.
+UringLoop::FdState& UringLoop::state(int fd) {
+    if (static_cast<std::size_t>(fd) >= fds.size()) {
+        fds.resize(fd + 1);
+    }
+
+    return fds[fd];
+}
+
+// Get a cleared submission entry, submitting queued ones if the ring is full.
+io_uring_sqe* UringLoop::next_sqe() {
+    if (local_tail - load_acquire(sq_head) == sq_entries) {
+        if (enter(0, 0, nullptr, 0) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            fatal("io_uring_enter failed.");
+        }
+    }
+
+    unsigned index = local_tail & sq_mask;
+    sq_array[index] = index;
+    ++local_tail;
+
+    io_uring_sqe* sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Publish queued entries and enter the kernel.
+int UringLoop::enter(unsigned min_complete, unsigned flags, void* arg, std::size_t arg_size) {
+    store_release(sq_tail, local_tail);
+    unsigned to_submit = local_tail - load_acquire(sq_head);
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                                    flags, arg, arg_size));
+}
+
+// Start watching a descriptor with given interest.
+void UringLoop::add(int fd, uint32_t interest) {
+    FdState& fs = state(fd);
+    ++fs.generation;
+    fs.interest = interest;
+    if (interest != 0) {
+        arm_poll(fd);
+    }
+}
+
+// Change the interest of a watched descriptor, replacing its poll.
+void UringLoop::modify(int fd, uint32_t interest) {
+    FdState& fs = state(fd);
+    if (fs.interest == interest) {
+        return;
+    }
+
+    if (fs.interest != 0) {
+        cancel(pack(OP_POLL, fs.generation, fd));
+    }
+    ++fs.generation;
+    fs.interest = interest;
+    if (interest != 0) {
+        arm_poll(fd);
+    }
+}
+
+// Stop watching a descriptor and cancel all its operations.
+// Cancelling by user_data works after the descriptor is closed, as requests hold the file.
+void UringLoop::remove(int fd) {
+    FdState& fs = state(fd);
+    if (fs.interest != 0) {
+        cancel(pack(OP_POLL, fs.generation, fd));
+    }
+    if (fs.accepting) {
+        cancel(pack(OP_ACCEPT, fs.generation, fd));
+    }
+    if (fs.receiving) {
+        cancel(pack(OP_RECV, fs.generation, fd));
+    }
+    if (fs.send_slot >= 0) {
+        cancel(pack(OP_SEND, 0, fs.send_slot));
+    }
+
+    uint32_t generation = fs.generation + 1;
+    fs = FdState{};
+    fs.generation = generation;
+}
+
+// Submit queued operations and wait for completions.
+bool UringLoop::wait(int64_t timeout, std::vector<Event>& events) {
+    events.clear();
+    done.clear();
+
+    // Data of the previous completions is consumed, give the buffers back.
+    if (!used_buffers.empty()) {
+        for (std::size_t i = 0; i < used_buffers.size(); ++i) {
+            recycle(used_buffers[i], i);
+        }
+        auto tail = std::atomic_ref<uint16_t>(buf_ring->tail);
+        tail.store(static_cast<uint16_t>(tail.load(std::memory_order_relaxed) + used_buffers.size()),
+                   std::memory_order_release);
+        used_buffers.clear();
+    }
+
+    for (int fd : starved) {
+        if (fds[fd].receiving) {
+            arm_receive(fd);
+        }
+    }
+    starved.clear();
+
+    __kernel_timespec ts{};
+    io_uring_getevents_arg arg{};
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+
+    if (enter(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0) {
+        if (errno == EINTR) {
+            return false;
+        } else if (errno != ETIME && errno != EBUSY && errno != EAGAIN) {
+            fatal("io_uring_enter failed.");
+        }
+    }
+
+    unsigned head = *cq_head;
+    unsigned tail = load_acquire(cq_tail);
+    for (; head != tail; ++head) {
+        dispatch(cqes[head & cq_mask], events);
+    }
+    store_release(cq_head, head);
+
+    return true;
+}
+
+// Name of the backend.
+char const* UringLoop::name() const {
+    return "io_uring";
+}
+
+// Accept connections on a listening socket until it is removed.
+void UringLoop::accept(int fd) {
+    FdState& fs = state(fd);
+    ++fs.generation;
+    fs.accepting = true;
+    arm_accept(fd);
+}
+
+// Receive from a socket until it is removed, stopped or the stream ends.
+// The generation is kept, so chunks of a stopped receive still in the ring are reported.
+void UringLoop::receive(int fd) {
+    FdState& fs = state(fd);
+    if (fs.receiving) {
+        return;
+    }
+
+    fs.receiving = true;
+    arm_receive(fd);
+}
+
+// Stop receiving from a socket, chunks already received are still reported.
+void UringLoop::stop_receiving(int fd) {
+    FdState& fs = state(fd);
+    if (!fs.receiving) {
+        return;
+    }
+
+    fs.receiving = false;
+    cancel(pack(OP_RECV, fs.generation, fd));
+}
+
+// Send messages over a socket, the slot keeps them alive until the send completes.
+void UringLoop::send(int fd, std::vector<std::string> messages) {
+    int index;
+    if (free_slots.empty()) {
+        index = static_cast<int>(slots.size());
+        slots.emplace_back();
+    } else {
+        index = free_slots.back();
+        free_slots.pop_back();
+    }
+
+    FdState& fs = state(fd);
+    fs.send_slot = index;
+
+    SendSlot& slot = slots[index];
+    slot.fd = fd;
+    slot.generation = fs.generation;
+    slot.messages = std::move(messages);
+    slot.iov.clear();
+    for (auto& message : slot.messages) {
+        slot.iov.push_back({message.data(), message.size()});
+    }
+    slot.first = 0;
+    slot.sent = 0;
+
+    submit_send(index);
+}
+
+// Socket operations completed during the last wait.
+std::vector<Completion> const& UringLoop::completions() const {
+    return done;
+}
+
+// Poll for the interest until the descriptor is removed or modified.
+void UringLoop::arm_poll(int fd) {
+    FdState const& fs = fds[fd];
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = to_poll_mask(fs.interest);
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = pack(OP_POLL, fs.generation, fd);
+}
+
+// Accept with a single multishot request, the peer address is not collected.
+void UringLoop::arm_accept(int fd) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = pack(OP_ACCEPT, fds[fd].generation, fd);
+}
+
+// Receive with a single multishot request, the kernel picks a provided buffer for each chunk.
+void UringLoop::arm_receive(int fd) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = pack(OP_RECV, fds[fd].generation, fd);
+}
+
+// Queue a send of the unsent part of the slot, at most MAX_SEND_MESSAGES iovecs.
+void UringLoop::submit_send(int index) {
+    SendSlot& slot = slots[index];
+    slot.msg = msghdr{};
+    slot.msg.msg_iov = slot.iov.data() + slot.first;
+    slot.msg.msg_iovlen = std::min(slot.iov.size() - slot.first, MAX_SEND_MESSAGES);
+
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = slot.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&slot.msg);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = pack(OP_SEND, 0, index);
+}
+
+// Queue a cancellation of the request with given user_data, its result is ignored.
+void UringLoop::cancel(uint64_t user_data) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = pack(OP_CANCEL, 0, 0);
+}
+
+// Put a buffer offset descriptors past the tail of the provided ring, published in bulk by the caller.
+void UringLoop::recycle(uint16_t buffer, std::size_t offset) {
+    uint16_t tail = std::atomic_ref<uint16_t>(buf_ring->tail).load(std::memory_order_relaxed);
+    // The header's flexible array member gets a wrong offset in C++, index the ring itself.
+    io_uring_buf& desc = reinterpret_cast<io_uring_buf*>(buf_ring)[(tail + offset) & (BUFFER_COUNT - 1)];
+    desc.addr = reinterpret_cast<uint64_t>(buffers + buffer * BUFFER_SIZE);
+    desc.len = BUFFER_SIZE;
+    desc.bid = buffer;
+}
+
+// Turn a completion into an event or a socket completion.
+// Multishot requests that end without being removed are armed again.
+void UringLoop::dispatch(io_uring_cqe const& cqe, std::vector<Event>& events) {
+    uint64_t op = op_of(cqe.user_data);
+    if (op == OP_SEND) {
+        dispatch_send(cqe);
+        return;
+    } else if (op == OP_CANCEL) {
+        return;
+    }
+
+    int fd = static_cast<int>(index_of(cqe.user_data));
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    bool current = static_cast<std::size_t>(fd) < fds.size()
+                && generation_of(cqe.user_data) == (fds[fd].generation & GENERATION_MASK);
+
+    if (op == OP_RECV && (cqe.flags & IORING_CQE_F_BUFFER)) {
+        uint16_t buffer = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        used_buffers.push_back(buffer);
+        if (current && cqe.res > 0) {
+            done.push_back({CompletionType::RECV, fd, cqe.res,
+                            std::string_view(buffers + buffer * BUFFER_SIZE, cqe.res)});
+        }
+    }
+
+    if (!current) {
+        // A connection accepted after removal has no owner.
+        if (op == OP_ACCEPT && cqe.res >= 0) {
+            close(cqe.res);
+        }
+        return;
+    }
+
+    FdState& fs = fds[fd];
+    switch (op) {
+        case OP_POLL:
+            if (cqe.res >= 0) {
+                uint32_t flags = 0;
+                if (cqe.res & POLLIN) {
+                    flags |= EVENT_READ;
+                }
+                if (cqe.res & POLLOUT) {
+                    flags |= EVENT_WRITE;
+                }
+                if (cqe.res & (POLLHUP | POLLERR | POLLNVAL)) {
+                    flags |= EVENT_ERROR;
+                }
+                events.push_back({fd, flags});
+            } else {
+                events.push_back({fd, EVENT_ERROR});
+            }
+
+            if (!more && fs.interest != 0) {
+                arm_poll(fd);
+            }
+            break;
+
+        case OP_ACCEPT:
+            done.push_back({CompletionType::ACCEPT, fd, cqe.res, {}});
+            if (!more) {
+                arm_accept(fd);
+            }
+            break;
+
+        case OP_RECV:
+            if (cqe.res == -ENOBUFS) {
+                // Out of buffers, retry once the consumed ones are back.
+                if (!more) {
+                    starved.push_back(fd);
+                }
+            } else if (cqe.res == -ECANCELED) {
+                // Stopped on purpose, a resumed receive may already be armed.
+            } else if (cqe.res <= 0) {
+                done.push_back({CompletionType::RECV, fd, cqe.res, {}});
+                if (!more) {
+                    fs.receiving = false;
+                }
+            } else if (!more && fs.receiving) {
+                arm_receive(fd);
+            }
+            break;
+    }
+}
+
+// Advance a send, report it once all data went out or on failure.
+void UringLoop::dispatch_send(io_uring_cqe const& cqe) {
+    int index = static_cast<int>(index_of(cqe.user_data));
+    SendSlot& slot = slots[index];
+    bool current = slot.fd >= 0 && static_cast<std::size_t>(slot.fd) < fds.size()
+                && fds[slot.fd].generation == slot.generation;
+
+    // Skip fully sent iovecs and trim a partially sent one.
+    if (current && cqe.res > 0) {
+        slot.sent += cqe.res;
+        std::size_t left = cqe.res;
+        while (slot.first < slot.iov.size() && left >= slot.iov[slot.first].iov_len) {
+            left -= slot.iov[slot.first].iov_len;
+            ++slot.first;
+        }
+        if (left > 0) {
+            slot.iov[slot.first].iov_base = static_cast<char*>(slot.iov[slot.first].iov_base) + left;
+            slot.iov[slot.first].iov_len -= left;
+        }
+
+        if (slot.first < slot.iov.size()) {
+            submit_send(index);
+            return;
+        }
+    }
+
+    if (current) {
+        fds[slot.fd].send_slot = -1;
+        done.push_back({CompletionType::SEND, slot.fd, cqe.res > 0 ? static_cast<int>(slot.sent) : cqe.res, {}});
+    }
+
+    slot.fd = -1;
+    slot.messages.clear();
+    free_slots.push_back(index);
+}
@@ -0,0 +1,141 @@
+#ifndef APPROX_URING_LOOP_H
+#define APPROX_URING_LOOP_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "event_loop.h"
+
+// Kinds of completed socket operations.
+enum class CompletionType {
+    ACCEPT,     // result is the accepted socket.
+    RECV,       // result is the number of received bytes, 0 at the end of stream.
+    SEND        // result is the number of sent bytes.
+};
+
+// Single completed socket operation, result is -errno on failure.
+struct Completion {
+    CompletionType type;
+    int fd;                     // Socket the operation was started on.
+    int result;
+    std::string_view data;      // Received bytes, valid until the next wait.
+};
+
+// Backend based on io_uring, all operations of one wakeup go to the kernel
+// with the single system call that waits for the next ones.
+// Descriptors added through the EventLoop interface are watched with multishot
+// polls, so it acts like an edge-triggered readiness loop. Sockets can instead
+// be handed to completion-based I/O: multishot accept, multishot receive into
+// buffers provided to the kernel and sends, results are reported by completions().
+// Completions of operations on removed descriptors are never reported.
+// Requires Linux 6.0, the ring must only be used by the thread that created it.
+class UringLoop : public EventLoop {
+    public:
+        // Set up the ring, nullptr if the kernel lacks io_uring or needed features.
+        static std::unique_ptr<UringLoop> create();
+
+        ~UringLoop() override;
+
+        UringLoop(UringLoop const&) = delete;
+        UringLoop& operator=(UringLoop const&) = delete;
+
+        void add(int fd, uint32_t interest) override;
+        void modify(int fd, uint32_t interest) override;
+
+        // Stop watching a descriptor and cancel all its operations.
+        // The descriptor may be closed right after.
+        void remove(int fd) override;
+
+        // Submit queued operations and wait for completions. Returns false if interrupted.
+        // Readiness goes to events, completed socket operations to completions().
+        bool wait(int64_t timeout, std::vector<Event>& events) override;
+        char const* name() const override;
+
+        // Accept connections on a listening socket until it is removed.
+        void accept(int fd);
+
+        // Receive from a socket until it is removed, stopped or the stream ends.
+        void receive(int fd);
+
+        // Stop receiving from a socket, receive() resumes.
+        // Chunks received before the stop are still reported.
+        void stop_receiving(int fd);
+
+        // Send messages over a socket, one send at a time per socket.
+        // Completes once all bytes are sent or on the first error.
+        void send(int fd, std::vector<std::string> messages);
+
+        // Socket operations completed during the last wait.
+        std::vector<Completion> const& completions() const;
+
+    private:
+        // Registration of a descriptor, operations of older ones are dropped.
+        struct FdState {
+            uint32_t generation{};      // Incremented on every registration and removal.
+            uint32_t interest{};        // Polled EVENT_* flags.
+            bool accepting{};           // Multishot accept armed.
+            bool receiving{};           // Multishot receive armed or waiting for buffers.
+            int send_slot{-1};          // Send in flight, -1 if none.
+        };
+
+        // Send in flight with the data it owns until completion.
+        struct SendSlot {
+            int fd{-1};
+            uint32_t generation{};
+            std::vector<std::string> messages{};
+            std::vector<iovec> iov{};
+            std::size_t first{};        // First iovec not fully sent.
+            std::size_t sent{};         // Bytes sent so far.
+            msghdr msg{};
+        };
+
+        UringLoop() = default;
+
+        bool setup();
+        FdState& state(int fd);
+        io_uring_sqe* next_sqe();
+        int enter(unsigned min_complete, unsigned flags, void* arg, std::size_t arg_size);
+        void arm_poll(int fd);
+        void arm_accept(int fd);
+        void arm_receive(int fd);
+        void submit_send(int slot);
+        void cancel(uint64_t user_data);
+        void recycle(uint16_t buffer, std::size_t offset);
+        void dispatch(io_uring_cqe const& cqe, std::vector<Event>& events);
+        void dispatch_send(io_uring_cqe const& cqe);
+
+        int ring_fd{-1};
+        void* ring{};                           // Submission and completion rings.
+        std::size_t ring_size{};
+        io_uring_sqe* sqes{};                   // Submission queue entries.
+        std::size_t sqes_size{};
+        unsigned* sq_head{};
+        unsigned* sq_tail{};
+        unsigned* sq_array{};
+        unsigned sq_mask{};
+        unsigned sq_entries{};
+        unsigned local_tail{};                  // Tail including entries not yet published.
+        unsigned* cq_head{};
+        unsigned* cq_tail{};
+        unsigned cq_mask{};
+        io_uring_cqe* cqes{};
+
+        io_uring_buf_ring* buf_ring{};          // Buffers provided for receives.
+        char* buffers{};                        // Storage of the provided buffers.
+        std::vector<uint16_t> used_buffers{};   // Buffers to return before the next wait.
+        std::vector<int> starved{};             // Receives to re-arm after returning buffers.
+
+        std::vector<FdState> fds{};
+        std::deque<SendSlot> slots{};           // Stable, the kernel reads msg during submission.
+        std::vector<int> free_slots{};
+        std::vector<Completion> done{};
+};
+
+#endif // APPROX_URING_LOOP_H